@@ -12,7 +12,7 @@ namespace math{
     
     void evaluate(double x);
 
-    double operator()(int degree, int order) { return _polyVals[degree]; };
+    double operator()(int degree, int order) { return _polyVals[ _ind(degree,order) ]; };
   
    private:
     int _maxDegree;
@@ -0,0 +1,25 @@
+#ifndef EIGENVALUE_H
+#define EIGENVALUE_H
+
+#include "solutionmanager.h"
+
+/// Eigenvalue solution manager
+/**
+ *  Solve a k-eigenvalue problem.  The converged eigenvalue and angular flux
+ *  are written to a state file that can be used as a transient initial condition.
+ **/
+class Eigenvalue : public SolutionManager
+{
+ public:
+  Eigenvalue(InputParser& input);
+  ~Eigenvalue();
+
+  void execute();
+
+ private:
+  void _saveSolutionState();
+
+  std::string _stateFileName;
+};
+
+#endif
@@ -1,11 +1,23 @@
 #ifndef FIXEDSOURCE_H
 #define FIXEDSOURCE_H
 
+#include <string>
+#include <vector>
+
 #include "solutionmanager.h"
 
 /// Fixed source solution manager
 /**
- *  Solve a fixed source problem.
+ *  Solve a fixed source problem.  If several external sources are given and
+ *  the solver can batch them (no fission, see SolverMOC::setBatchedSources),
+ *  they are iterated together and every sweep solves all of them.  Otherwise
+ *  each is solved in turn with the same solver, sharing only the solver setup.
+ *
+ *  For problems that are linear in the external source (no fission and no
+ *  boundary source), the scalar flux responses to the given (basis) sources
+ *  can be cached.  Later runs with the same solver type and tolerance, mesh,
+ *  materials, quadrature, boundary conditions and basis sources read the
+ *  responses instead of solving, and answer linear combinations of the bases by superposition.
  **/
 class FixedSource : public SolutionManager
 {
@@ -17,6 +29,18 @@ class FixedSource : public SolutionManager
 
  private:
   void _saveSolutionState();
+  void _saveSourceFlux(int k);
+
+  // Response function cache
+  bool _isLinearInSource();
+  void _solveWithResponseCache();
+  void _computeCacheKey(int* key);
+  bool _readResponseCache(int* key, int& numBases, std::vector<double>& responses);
+  void _writeResponseCache(int* key, int numBases, std::vector<double>& responses);
+  void _writeScalarFlux(double* flux, std::string suffix);
+
+  std::string _responseCacheName;
+  std::vector<double> _responseCoefficients;
 };
 
 #endif
@@ -19,6 +19,8 @@ namespace Logging
       Logger(const std::string& name);
       ~Logger();
 
+      void reopen(const std::string& name);
+
       template< SeverityType severity, typename...Args >
         void print( Args...args);
   
@@ -54,6 +56,17 @@ namespace Logging
     }
 
 
+  /// Continue the log in another file
+  template< typename LogPolicy >
+    void
+    Logger<LogPolicy>::reopen(const std::string& name)
+    {
+      _policy->closeOStream();
+      _policy->openOStream(name);
+      _policy->write("Radiation Transport Log");
+    }
+
+
   template< typename LogPolicy >
     template< SeverityType severity, typename...Args >
     inline void
@@ -2,6 +2,7 @@
 #define MESHINTERFACE_H
 
 #include <string>
+#include <vector>
 
 #include "element.h"
 #include "material.h"
@@ -31,6 +32,8 @@ class MeshInterface
   virtual void readMeshSweepOrder(const std::string fileName) = 0;
   virtual void createDefaultMeshSweepOrder() = 0;
 
+  std::vector<int> elementPartition;  //!< Rank owning each element (empty if not decomposed)
+
  protected:
   int _dimension;
   long _numNodes;
@@ -32,7 +32,10 @@ class MoabMesh : public MeshInterface
   void tagMesh(std::string tagName, double* tagDataBuffer, long tagSize);
   void readMeshSweepOrder(const std::string fileName);
   void createDefaultMeshSweepOrder() {} ;
+  int createMeshSweepOrder(const std::vector<double>& omega_x, const std::vector<double>& omega_y);
   double getElementVolume( long elemID );
+  void partitionMesh(int numParts, bool refine = true,
+                     const std::vector<double>& weights = std::vector<double>());
 
   // MOAB-specific implementations
   void logMemoryUse();
@@ -43,11 +46,16 @@ class MoabMesh : public MeshInterface
   moab::Interface* _mb;
   
   std::vector<moab::EntityHandle> _orderedMeshSet;
+  std::map<std::vector<double>, int> _createdSweepOrders;  ///< First created set of each direction list (omega_x, then omega_y)
   std::vector<moab::EntityHandle> _tris;
   moab::Range _verts;
 
   void _identifyEdges();
   void _identifyBoundaryElements();
+  void _bisectPartition(std::vector<long>& elements, int firstPart, int numParts, bool refine,
+                        const std::vector<double>& weights,
+                        const std::vector<double>& xc, const std::vector<double>& yc,
+                        const std::vector<long>& neighbors);
   std::map<std::pair<long, long>, long> _edgeID;
 
   std::vector<Material*> _materialList;
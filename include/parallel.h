@@ -0,0 +1,42 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <vector>
+#include <string>
+
+/// Parallel environment: MPI ranks and the threads of each rank
+/**
+ *  Thin wrapper around the few MPI operations the solvers need.  Without
+ *  USE_MPI (or when run as a single process) there is one rank and every
+ *  reduction is the identity, so callers need no special cases.  Threads can
+ *  be pinned to the CPUs the rank may run on.
+ */
+class Parallel
+{
+ public:
+  static void initialize(int* argc, char*** argv);
+  static void finalize();
+
+  static int rank() { return _rank; };
+  static int size() { return _size; };
+  static bool isRoot() { return _rank == 0; };
+
+  static double sumAll(double value);
+  static double maxAll(double value);
+  static void sumAll(double* data, long size);
+  static void maxAll(double* data, long size);
+
+  static void exchange(const std::vector<int>& ranks,
+                       std::vector< std::vector<double> >& sendBuffers,
+                       std::vector< std::vector<double> >& recvBuffers);
+
+  static void pinThreads(const std::string& policy);
+  static void reportThreadPlacement();
+
+ private:
+  static std::vector< std::vector<int> > _numaNodeCPUs();
+  static int _rank;
+  static int _size;
+};
+
+#endif
@@ -25,6 +25,9 @@ class SolutionManager
  protected:
   SolutionManager(ProblemType problemType, InputParser& input);
   virtual void _saveSolutionState() = 0;
+  SolverBase* _createSolver(TransportProblem& problem, std::string solverType = "");
+  void _copySolverConfiguration(SolverBase* target);
+  void _solveWithWarmStart();
 
   MaterialFactory materialFactory;
   MeshFactory meshFactory;
@@ -35,7 +38,10 @@ class SolutionManager
   InputParser& _input;
   Output* _output;
 
- private:
+  bool _quadratureContinuation;
+  bool _diffusionInitialGuess;
+  bool _reportWarmStartSavings;
+
   void _dumpBaseSolution(std::string fileName);
 };
 
@@ -3,11 +3,13 @@
 
 #include<vector>
 #include<map>
+#include<algorithm>
 
 #include "transportproblem.h"
 #include "dofobj.h"
 #include "timing.h"
 #include "output.h"
+#include "parallel.h"
 
 /// Source configuration description
 /**
@@ -22,6 +24,22 @@ struct SourceConfiguration
 };
 
 
+/// Boundary condition plan entry
+/**
+ *  Applying the entry copies the incoming boundary flux into target (the
+ *  boundary flux used by the sweep).  The flux is the solution DOF
+ *  solutionIndex for reflections, otherwise value (a boundary source, or zero
+ *  for vacuum).  Reflections are stored by index since the solution buffers
+ *  may be swapped.
+ **/
+struct BoundaryPlanEntry
+{
+  double* target;
+  const double* value;
+  long solutionIndex;
+};
+
+
 /// Abstract solver class
 /**
  *  DOFlist provides an ordering of the DOFs
@@ -33,6 +51,7 @@ class SolverBase
   virtual ~SolverBase();
 
   virtual void solve() = 0;
+  virtual void setupDecomposition() {};   ///< Apply the parallel settings; call before the solver arrays are used
 
   // Error/convergence calculators
   double calculateL2SolutionNorm(double* solutionComp);
@@ -42,29 +61,53 @@ class SolverBase
   double calculateRInfSolutionError();
 
   // Getters
-  const double* getSolutionValue(long space_i, int quad_n, int group_g)
-    { return DOFmap[ DOFObj(space_i, quad_n, group_g) ]; }
+  const double* getSolutionValue(long space_i, int quad_n, int group_g);
   const double* getSolutionValue(long i)
     { return &_solution[i]; };
   long getNumDOFs() { return _numDOF; };
+  virtual long getNumGlobalDOFs() { return _numDOF; };  ///< DOFs of the whole mesh, as written by the root
+  long getNumSweeps() { return _numSweeps; };
   TransportProblem& getTransportProblem() { return _prob; };
   virtual double getScalarFlux(long space_i, int group_g) = 0;
+  virtual double getSubCellScalarFlux(long space_i, int group_g, int subCell) = 0;
   double getNeutronProduction(long space_i);
   double getTotalNeutronProduction();
 
   // Setters
   void setRInfTol(double tol) { _convRInfTol = tol; };
   void setMaxIters(int maxIters) { _maxIters = maxIters; };
+  void setFissionTol(double tol) { _convFissionTol = tol; };
+  void setWielandtShift(double shift) { _wielandtShift = shift; };
+  void setChebyshevExtrapolation(bool useChebyshev) { _useChebyshev = useChebyshev; };
+  void setFreezeConvergedGroups(bool freeze) { _freezeConvergedGroups = freeze; };
+  void setReflectiveSweepOrder(bool reflective) { _reflectiveSweepOrder = reflective; };
+  void setAdaptiveInnerTol(bool adaptive) { _adaptiveInnerTol = adaptive; };
+  void setMaxInnerTol(double tol) { _innerTolMax = tol; };
+  void setInexactTol(double tol);
+  void setAngularConvergence(bool angular) { _angularConvergence = angular; };
+  void setCacheSweepGeometry(bool cache) { _cacheSweepGeometry = cache; };
+  void setAngularDecomposition(bool angular) { _angularDecomposition = angular; };
+  void setRefinePartition(bool refine) { _refinePartition = refine; };
+  void setThreadSubdomains(bool subdomains) { _threadSubdomains = subdomains; };
+  void setAutoThreading(bool autoThreading) { _autoThreading = autoThreading; };
+  void setOutOfCore(std::string directory) { _outOfCoreDirectory = directory; };
+  void setAngleBlockSize(int size) { _angleBlockSize = size; };
+  void setStoredGroups(int numGroups);
+  void setSweepFrontStorage(bool front) { _sweepFrontStorage = front; };
 
   // Utilitiy functions
-  void setSolution(double* solution);
+  virtual void setSolution(double* solution);
   double* copySolution(double* solutionCopy);
   void normalizeSolution(double totalProductionRate);
   void zeroSolution();
+  void seedScalarFlux(SolverBase& guess);
   void extrapolateSolution(double expExtrapFactor);
   void extrapolateSolution(double expExtrapFactor, double* baseSolution);
   void writeSolution(Output* outputFile);
-  void writeScalarFlux(Output* outputFile);
+  void writeScalarFlux(Output* outputFile, std::string suffix = "");
+  virtual void writeBoundaryFlux(Output*, std::string = "") {};  ///< Only solvers with edge angular fluxes write them
+  virtual bool setBatchedSources(int numSources) { return numSources == 1; };  ///< Sweep all external sources together; false if not supported
+  virtual void selectBatchedSource(int) {};  ///< Make the fluxes of one batched source current (e.g., for output)
 
   void printIterStatus(std::string name, int iter, double err, double tol);
 
@@ -72,14 +115,58 @@ class SolverBase
 
   double sourceScaling;       ///< This scales the external source, but is used as a fission source in the power method
   double criticalEigenvalue;  ///< "Critical" eigenvalue for transient calculations based on ICs from an eigenvalue calculation
+  bool eigenvalueMode;        ///< Solve for k by scaling the fission source by 1/k in the outer iterations
 
  protected:
   SolverBase(TransportProblem &tp);   ///< Constructor
   void _calculateResidual();
   virtual void _mapDOFs() = 0;
+  virtual long _solutionIndex(long, int, int) { return -1; };  ///< DOF of the map entry, or -1 if not kept
+  virtual long _cellFluxIndex(long space_i, int quad_n, int group_g, int subCell) = 0;
   virtual void _calculateMatrixAction(double* x, double* y) = 0;
 
   void _saveOldSolution();
+  void _saveOldFlux();
+  void _restoreSolutionStorage();
+  void _scaleSolution(double factor);
+
+  // Cells swept by this rank with a spatial decomposition
+  bool _spatialDecomposition() { return _prob.mesh->elementPartition.size() > 0; };
+  bool _ownsCell(long i)
+    { return !_spatialDecomposition() || _prob.mesh->elementPartition[i] == Parallel::rank(); };
+
+  // Fission source (outer) iterations
+  void _initializeFissionIteration();
+  void _calculateFissionDensity(double* density);
+  double _calculateFissionProduction(double* density);
+  double _getFissionSource(long space_i, int group_g, int subCell);
+  bool _updateFissionIteration(int fissionIter);
+
+  // Inexact inner iterations
+  void _initializeInnerTolerance();
+  void _updateInnerTolerance(double outerResidual);
+
+  // Per-group inner convergence
+  void _initializeGroupConvergence();
+  double _updateGroupConvergence();
+  virtual void _calculateCachedScalarFlux(bool activeGroupsOnly);
+
+  // Anisotropic scattering
+  void _buildMomentOperators();
+  void _addAnisotropicScatterSource();
+
+  // Reflective boundary sweep ordering
+  void _linkReflectedDirections(int n, int np);
+  int _findReflectionRoot(int n);
+  void _buildReflectionSets();
+
+  // Precomputed boundary condition plan
+  void _initializeBoundaryPlan();
+  void _addBoundaryPlanEntry(int n, const DOFObj& bdryDOF, const double* value);
+  void _addBoundaryPlanEntry(int n, const DOFObj& bdryDOF, long solutionIndex);
+  bool _addFileBoundarySource(int n, long edge, long bdryID, int numEdgeLocs);
+  void _executeBoundaryPlan(int angle = -1);
+  int& _reflectedDirection(double nx, double ny, int n);
 
   TransportProblem &_prob;                //!< Reference to the base transport problem
 
@@ -94,12 +181,103 @@ class SolverBase
   double *_h;                             //!< Mesh spacing
 
   double *_solutionPrev;
+  double *_cellFlux;                      //!< Cell (or sub-cell) angular flux
+  unsigned int _numPhaseSpaceDOF;         //!< Number of cell angular flux DOF
+  int _numSubCells;                       //!< Number of flux sub-cells per element
+  long _numSweeps;                        //!< Number of transport sweeps (over all directions) performed
 
   double _convRInfTol;
   int _maxIters;
 
+  // Adaptive (Eisenstat-Walker) inner tolerance data
+  bool _adaptiveInnerTol;
+  double _innerTol;                       //!< Inner iteration tolerance used for the current outer iteration
+  double _innerTolMax;                    //!< Loosest inner tolerance allowed
+  double _inexactTol;                     //!< Accuracy requested by an enclosing (e.g., time step) iteration
+  double _forcingTerm;
+  double _prevOuterResidual;
+
+  // Fission source iteration data.  Fission densities are stored per sub-cell
+  // and summed over groups; chi is applied when the source is formed.
+  double *_fissionDensity;                //!< Fission density of the current iterate
+  double *_fissionDensityOuter;           //!< Fission density lagged at the start of the outer iteration
+  double *_fissionDensityOuterPrev;       //!< Lagged fission density from the previous outer iteration
+  double _convFissionTol;
+  double _wielandtShift;                  //!< Shift, delta, such that lambda_s = 1/(k + delta)
+  double _lambda;                         //!< Fission source scaling, 1/k (unity outside of eigenvalue mode)
+  double _lambdaShift;                    //!< Fission source scaling kept inside the inner iterations
+  double _prevFissionProduction;
+  bool _useChebyshev;
+  int _chebyshevIter;                     //!< Position in the current Chebyshev cycle (0 = unaccelerated)
+  double _dominanceRatio;
+  double _prevFissionResidual;
+
+  // Per-group convergence data.  Inactive (frozen) groups are neither swept nor
+  // have their scattering source recomputed.
+  bool _freezeConvergedGroups;
+  std::vector<bool> _groupActive;
+  std::vector<double> _groupRInfNorm;
+  std::vector<bool> _groupCoupling;       //!< [gp*G + g] is true if group gp scatters into group g != gp
+
+  // Inner convergence is tested on the sub-cell scalar flux (ordered by cell,
+  // group, sub-cell) unless the angular edge flux norm is requested.  Old values
+  // are kept by swapping buffers rather than copying.
+  bool _angularConvergence;
+  double *_scalarFlux;
+  double *_scalarFluxPrev;
+  double *_solutionStorage;               //!< Buffer _solution pointed to before any swap (DOFmap points here)
+  bool _reflectFromPrev;                  //!< Solution buffers were swapped: the last sweep's fluxes are in _solutionPrev
+
+  // Real spherical harmonic moment operators for P_N scattering.  Moments are
+  // ordered (l,m) = (0,0), (1,-1), (1,0), (1,1), ...
+  int _numMoments;
+  std::vector<int> _momentDegree;         //!< Legendre degree l of each moment
+  std::vector<double> _discreteToMoment;  //!< [k*Q + n] angular flux to moment k (weights included)
+  std::vector<double> _momentToDiscrete;  //!< [n*M + k] moment k to direction n, including (2l+1)
+  std::vector<double> _reducedFluxMoments;  //!< Moments summed over the ranks' directions, ordered (cell, sub-cell, group, moment)
+  bool _reducedFluxMomentsValid;
+
+  // Directions that are mapped onto each other by reflecting boundaries.  Each
+  // set is swept in sequence (so reflected boundary fluxes are fresh) while
+  // different sets are swept in parallel.
+  bool _reflectiveSweepOrder;
+  std::vector<int> _reflectionParent;
+  std::vector< std::vector<int> > _reflectionSets;
+
+  bool _cacheSweepGeometry;               //!< Keep per-direction element orientations between sweeps
+
+  // Angular decomposition: each rank sweeps every size-th direction and the
+  // scalar flux is summed over ranks.  While valid, solvers return the summed
+  // sub-cell scalar flux (ordered like _scalarFlux) instead of their own.
+  bool _angularDecomposition;
+  bool _refinePartition;                  //!< Refine coordinate bisections of the mesh to reduce cut edges
+  bool _threadSubdomains;                 //!< Threads sweep spatial subdomains instead of directions
+  bool _autoThreading;                    //!< Choose the thread decomposition from timed trial sweeps
+  std::string _outOfCoreDirectory;        //!< Angular flux arrays are file backed here (in memory if empty)
+  int _angleBlockSize;                    //!< Directions swept together out of core (0: one per thread, at least a page)
+  bool _sweepFrontStorage;                //!< Edge fluxes are only kept on the sweep front and the boundary
+
+  // Group block storage: angular flux arrays hold the groups
+  // _firstStoredGroup, ..., _endStoredGroup()-1 only, and the scalar flux of
+  // every group is kept in _reducedScalarFlux
+  int _firstStoredGroup;
+  int _numStoredGroups;                   //!< Groups per block (the group stride of the angular arrays)
+  int _endStoredGroup() { return std::min(_firstStoredGroup + _numStoredGroups, _prob.numGroups); };
+  bool _groupBlockStorage() { return _numStoredGroups < _prob.numGroups; };
+  bool _storesGroup(int g) { return g >= _firstStoredGroup && g < _endStoredGroup(); };
+  bool _ownsDirection(int n) { return !_angularDecomposition || n % Parallel::size() == Parallel::rank(); };
+  double* _reducedScalarFlux;
+  bool _reducedScalarFluxValid;
+
   std::map<DOFObj, double> _bdryFlux;
 
+  // Boundary conditions are resolved once (orientation, normals, reflected
+  // directions and source lookup) into per-direction lists of copies.
+  std::vector< std::vector<BoundaryPlanEntry> > _bcPlan;
+  std::vector<double> _bcNormals;         //!< Distinct boundary normals (nx,ny pairs)
+  std::vector<int> _bcReflectedDir;       //!< [normal*Q + n] reflected direction (-2 if not yet found)
+  double _zeroBoundaryFlux;               //!< Incoming flux for vacuum boundaries
+
   
 };
 
@@ -0,0 +1,61 @@
+#ifndef SOLVERDIFFUSION_H
+#define SOLVERDIFFUSION_H
+
+#include "solverbase.h"
+#include "moabmesh.h"
+
+/// Multigroup diffusion solver
+/**
+ *  Cell-centered finite volume diffusion on the (triangular) transport mesh
+ *  with D = 1/(3 sigma_t).  This is a low-order solver meant for quick previews
+ *  and for seeding the scalar flux of the transport solvers.
+ *
+ *  The solution is stored as the angle-averaged flux, phi/(4 pi), so that
+ *  getScalarFlux is consistent with the transport solvers.
+ */
+class SolverDiffusion : public SolverBase
+{
+ public:
+  SolverDiffusion( TransportProblem &tp );
+  ~SolverDiffusion();
+  void solve();
+  double getScalarFlux(long space_i, int group_g)
+    { return _solution[_dofIndex(space_i, group_g)]; };
+  double getSubCellScalarFlux(long space_i, int group_g, int)
+    { return getScalarFlux(space_i, group_g); };
+
+ private:
+  long _dofIndex(long i, int g)
+    { return _prob.numGroups*i + g; };
+  long _cellFluxIndex(long i, int, int g, int)
+    { return _dofIndex(i,g); };
+  void _mapDOFs();
+  void _calculateMatrixAction(double* x, double* y);
+
+  void _setupGeometry();
+  void _calculateSource();
+  void _solveGroup(int g);
+  void _applyOperator(int g, double* x, double* y);
+  double _getIsotropicExtSource(long i, int g);
+  double _getIsotropicBoundarySource(long edge, int g, double nx, double ny);
+
+  MoabMesh* mesh;
+
+  // Geometry, per element edge (3*i + v)
+  std::vector<long> _neighbor;             //!< Neighboring element (or -(v+1) on the boundary)
+  std::vector<double> _edgeLength;
+  std::vector<double> _edgeDistance;       //!< Distance from the centroid to the edge
+  std::vector<double> _boundarySource;     //!< Incoming angular flux by edge and group (-1 = reflecting)
+  std::vector<double> _volume;
+
+  // Per-group work arrays
+  double* _diag;
+  double* _rhs;
+  double* _r;
+  double* _z;
+  double* _p;
+  double* _q;
+  double* _x;
+};
+
+#endif
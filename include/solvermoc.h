@@ -0,0 +1,194 @@
+#ifndef SOLVERMOC_H
+#define SOLVERMOC_H
+
+#include "solverbase.h"
+#include "moabmesh.h"
+
+
+/// Common sweep framework of the MOC solvers
+/**
+ *  Owns the quadrature geometry, the source iteration, source construction,
+ *  boundary condition application and the mesh traversal.  A method only
+ *  supplies its DOF layout, boundary plan and the characteristic solve of a
+ *  single element, so changes to the traversal apply to all MOC solvers.
+ */
+class SolverMOC : public SolverBase
+{
+ public:
+  SolverMOC( TransportProblem &tp );
+  ~SolverMOC();
+  void solve();
+  void setupDecomposition();
+  void writeBoundaryFlux(Output* outputFile, std::string suffix = "");
+  long getNumGlobalDOFs();
+  void setSolution(double* solution);
+  bool setBatchedSources(int numSources);
+  void selectBatchedSource(int source);
+
+ protected:
+  void _calculateSphericalQuadrature();
+  int _getReflectedDirection(int i, double nx, double ny, double& OmegaDotn);
+  double _getAngleFromVector(double dx, double dy);
+  std::vector<double> _mu;
+  std::vector<double> _theta;
+  std::vector<int> _negDir;
+
+  MoabMesh* mesh;
+
+  // Sweeps solve the groups firstGroup, ..., lastGroup-1 of one direction.
+  // Groups are independent within a sweep (the scatter source is lagged), so
+  // one direction can be split into group blocks swept concurrently.
+  virtual void _sweep(int n, int firstGroup, int lastGroup);
+  virtual void _solveElement(UltraLightElement& element, long elementID, int n,
+                             int firstGroup, int lastGroup) = 0;
+  virtual void _prepareSweep(int) {};
+  void _sweepAllDirections();
+  void _sweepAngleGroupBlocks();
+  int _groupBlockSize;           //!< Groups per sweep task (0 until chosen)
+  bool _groupBlockSizeTuned;     //!< Block size has been resized from measured task times
+
+  // Automatic choice of the thread decomposition: a cost model from the
+  // problem dimensions selects the candidates, timed trial sweeps pick one
+  enum SweepStrategy {angleSweeps, angleGroupSweeps, subdomainSweeps, numSweepStrategies};
+  void _selectSweepStrategy();
+  void _setSweepStrategy(SweepStrategy strategy);
+  double _timeSweeps(int numSweeps);
+  std::string _sweepStrategySignature();
+
+  void _applyBoundaryConditions(int angle = -1);
+  virtual void _buildBoundaryPlan() = 0;
+
+  void _calculateSource();
+  void _getExternalSource();
+  void _addFissionSource();
+  void _addScatterSource();
+  virtual void _addIsotropicScatterSource();
+  void _calculateMatrixAction(double*, double*) {};
+
+  // Edge and cell angular flux arrays are allocated by setupDecomposition,
+  // once it is known whether they are kept in memory or out of core
+  virtual void _allocateStorage() = 0;
+  double* _allocateAngularArray(long size);
+  void _freeAngularArray(double* data);
+  std::map<double*, long> _mappedArrays;  //!< File backed arrays and their sizes
+  void _prefetchDirections(int firstDirection, int lastDirection);
+
+  // Group block storage: blocks of groups are solved in turn (Gauss-Seidel
+  // in energy) and only the scalar flux of the other groups is kept
+  void _initializeGroupBlockStorage();
+  void _setStoredGroupBlock(int firstGroup);
+  void _storeBlockScalarFlux();
+  double _groupBlockIterations(int& scatterIter);
+
+  // Batched external sources: without fission the sources of a fixed source
+  // problem are iterated together and each sweep solves all of them, sharing
+  // the element orientations, sweep order and boundary fluxes.  Every source
+  // keeps its own flux arrays; those of the active source are the solver's
+  // arrays, those of the others are parked in _batchedArrays.
+  struct BatchedSourceArrays
+  {
+    double *solution, *solutionPrev, *solutionStorage;
+    double *source, *cellFlux;
+    double *scalarFlux, *scalarFluxPrev;
+    bool reflectFromPrev;
+  };
+  int _numBatchedSources;
+  int _activeSource;
+  std::vector<BatchedSourceArrays> _batchedArrays;
+  void _activateSource(int s);
+  double _batchedSourceIterations(int& scatterIter);
+
+  // Arrays of batched source s during a sweep, which runs with source 0 active
+  double* _batchedSolution(int s) { return s == 0 ? _solution : _batchedArrays[s].solution; };
+  const double* _batchedSource(int s) { return s == 0 ? _source : _batchedArrays[s].source; };
+  double* _batchedCellFlux(int s) { return s == 0 ? _cellFlux : _batchedArrays[s].cellFlux; };
+
+  // Sweep front storage: the edge fluxes of a direction occupy a slot from
+  // the sweep batch of their upwind element to that of their downwind
+  // element, after which the slot is reused.  Boundary edges keep a slot for
+  // every direction, read by reflections and the boundary flux output.
+  virtual void _sweepOrder(int n, std::vector<long>& order, std::vector<long>& batchStart);
+  void _buildSweepFront();
+  std::vector<int> _edgeSlot;            //!< [e*Q + n] slot of the edge DOFs of direction n on edge e
+  long _numEdgeSlots;
+  long _numEdgeDOFs()
+    { return (_sweepFrontStorage ? _numEdgeSlots : _numLocalEdges*_prob.quadOrder)*2*_numStoredGroups; };
+
+  /// First edge DOF of direction n on edge e (followed by the stored groups)
+  long _edgeOffset(long e, int n)
+  {
+    long slot = _sweepFrontStorage ? _edgeSlot[e*_prob.quadOrder + n] : _edgeIndex(e)*_prob.quadOrder + n;
+    return slot*2*_numStoredGroups;
+  };
+
+  // Spatial decomposition across MPI ranks (block Jacobi with lagged
+  // interface fluxes).  Each (edge, direction) entry is the edge DOFs of all
+  // stored groups of one direction, sent by the rank owning the upwind element.
+  // Ranks other than the root only keep the angular fluxes of their own cells
+  // and of the edges of these cells; the root keeps all of them, since the
+  // solution is gathered there for output.
+  void _partitionMesh();
+  void _buildLocalStorage();
+  std::vector<long> _localCell;          //!< [i] position of cell i in the cell arrays (-1 if not kept)
+  std::vector<long> _localEdge;          //!< [e] position of edge e in the edge arrays (-1 if not kept)
+  long _numLocalCells;
+  long _numLocalEdges;
+  bool _storesCell(long i) { return _localCell.empty() || _localCell[i] >= 0; };
+  bool _storesEdge(long e) { return _localEdge.empty() || _localEdge[e] >= 0; };
+  long _cellIndex(long i) { return _localCell.empty() ? i : _localCell[i]; };
+  long _edgeIndex(long e) { return _localEdge.empty() ? e : _localEdge[e]; };
+
+  bool _decompositionInitialized;
+  void _initializeDecomposition();
+  void _placeStorage();
+  void _buildInterfaceExchange();
+  void _exchangeInterfaceFlux();
+  void _gatherSolution();
+  std::vector<int> _neighborRanks;
+  std::vector< std::vector<long> > _sendOffsets;  //!< [k] first DOF of each entry sent to _neighborRanks[k]
+  std::vector< std::vector<long> > _recvOffsets;  //!< [k] first DOF of each entry received from _neighborRanks[k]
+  std::vector<int> _edgeOwner;                    //!< Rank sending each edge to the root in the gathered solution
+  std::vector<double*> _interfaceArrays;          //!< Edge DOF arrays exchanged along with the solution
+
+  // Angular decomposition
+  void _reduceAngularFlux();
+  void _sumBoundaryEdgeFlux();
+  void _sumOwnedDirections(double* cellFlux, double* edgeFlux);
+  std::vector<long> _boundaryEdges;      //!< Edges on the mesh boundary, exchanged for reflections
+
+  // Shared memory block Jacobi: each thread sweeps all directions over its own
+  // subdomain.  Edges between subdomains are written by the upwind subdomain
+  // to a staging buffer that is copied into the solution after all subdomains
+  // are swept, so their fluxes lag by one iteration and no edge DOF is read
+  // and written by different threads during a sweep.
+  int _numSubdomains;
+  void _buildSubdomains();
+  std::vector<int> _subdomainPartition;  //!< Part of each cell in the (ranks x threads) partition
+  void _sweepSubdomains();
+  std::vector< std::vector< std::vector<long> > > _subdomainOrder;  //!< [s][n] cells of subdomain s in sweep order
+  std::vector<long> _subdomainSlot;      //!< Staging slot of each edge (-1 unless between subdomains)
+  std::vector<long> _subdomainSlotEdge;  //!< Edge of each staging slot
+  std::vector<double*> _stagedEdgeFlux;  //!< [array] staged edge DOFs, ordered (slot, direction, group, loc)
+
+  /// The two edge DOFs of direction n and group g on edge e, to be written by
+  /// the upwind element.  Array 0 is the solution, array a > 0 is
+  /// _interfaceArrays[a-1].
+  double* _outgoingEdgeDOFs(long e, int n, int g, int array = 0)
+  {
+    long block = 2*_numStoredGroups;
+    long offset = 2*(g - _firstStoredGroup);
+    if (_numSubdomains > 1 && _subdomainSlot[e] >= 0)
+      return _stagedEdgeFlux[array] + (_subdomainSlot[e]*_prob.quadOrder + n)*block + offset;
+    return (array == 0 ? _solution : _interfaceArrays[array-1]) + _edgeOffset(e, n) + offset;
+  };
+
+  /// The outgoing edge DOFs of batched source s (batches are not split into subdomains)
+  double* _outgoingBatchedDOFs(long e, int n, int g, int s)
+  {
+    if (s == 0)
+      return _outgoingEdgeDOFs(e, n, g);
+    return _batchedArrays[s].solution + _edgeOffset(e, n) + 2*(g - _firstStoredGroup);
+  };
+};
+
+#endif
@@ -1,18 +1,20 @@
 #ifndef SOLVERREGMOC_H
 #define SOLVERREGMOC_H
 
-#include "solverbase.h"
-#include "moabmesh.h"
+#include "solvermoc.h"
 
 // This needs to be updated to four subcells
 struct TriangleDescriptorReg
 {
   long edgeNeighbor, vertexNeighbor1, vertexNeighbor2;
+  // mesh edges shared with the neighbors
+  long edgeEdge, vertexEdge1, vertexEdge2;
   // subcell intercell boundary fluxes
   double psi01, psi13, psi21;
   // triangle boundary fluxes
   double psi0,psi1,psi2,psi3,psi4,psi5;
-  // subcell fluxes
+  // subcell sources and fluxes (of subcells i0, ..., i3)
+  double q0,q1,q2,q3;
   double cell0,cell1,cell2,cell3;
   double sigma;
   double edge01[2], edge12[2], edge20[2];
@@ -21,50 +23,84 @@ struct TriangleDescriptorReg
   int i0, i1, i2, i3;
 };
 
+/// Cached orientation of one element for one direction
+struct SweepPlanElement
+{
+  long elementID;
+  int blockID;
+  int level;                 //!< Sweep wavefront the element belongs to
+  double theta;
+  TriangleDescriptorReg tri;
+
+  // Elements are batched by wavefront, then by vertex to edge / edge to vertex case
+  static bool batchOrder(const SweepPlanElement& a, const SweepPlanElement& b)
+    { return a.level < b.level || (a.level == b.level && a.blockID % 2 > b.blockID % 2); };
+};
+
 
 
 /// LocalMOC Solver
 /**
  *  Still under active development
  */
-class SolverRegMOC : public SolverBase
+class SolverRegMOC : public SolverMOC
 {
  public:
   SolverRegMOC( TransportProblem &tp );
   ~SolverRegMOC();
-  void solve();
   double* getResidual();
   double getScalarFlux(long space_i, int group_g);
+  double getSubCellScalarFlux(long space_i, int group_g, int subCell);
 
  private:
+  // Angular arrays hold the stored groups only
   long _dofIndex(long i, int n, int g, int edgeLoc=0)
-    { return 2*_prob.quadOrder*_prob.numGroups*i + 2*_prob.numGroups*n + 2*g + edgeLoc; };
+    { return _edgeOffset(i,n) + 2*(g - _firstStoredGroup) + edgeLoc; };
   long _dofIndexPS(long i, int n, int g, int subCell=0)
-    { return 4*_prob.quadOrder*_prob.numGroups*i + 4*_prob.numGroups*n + 4*g + subCell; };
+    { return 4*_prob.quadOrder*_numStoredGroups*_cellIndex(i) + 4*_numStoredGroups*n + 4*(g - _firstStoredGroup) + subCell; };
+  long _cellFluxIndex(long i, int n, int g, int subCell)
+    { return _dofIndexPS(i,n,g,subCell); };
+  long _solutionIndex(long i, int n, int g)
+    { return (_storesEdge(i) && _storesGroup(g) && !_sweepFrontStorage) ? _dofIndex(i,n,g) : -1; };
   void _mapDOFs();
-
-  void _calculateSphericalQuadrature();
-  int _getReflectedDirection(int i, double nx, double ny, double& OmegaDotn);
-  std::vector<double> _mu;
-  std::vector<double> _theta;
-  std::vector<int> _negDir;
-
-  MoabMesh* mesh;
-
-  double* _cellFlux;
-
-  void _sweep(int n);
+  void _allocateStorage();
+
+  void _sweep(int n, int firstGroup, int lastGroup);
+  void _solveElement(UltraLightElement& element, long elementID, int n,
+                     int firstGroup, int lastGroup);
+  void _prepareSweep(int n);
+  void _sweepOrder(int n, std::vector<long>& order, std::vector<long>& batchStart);
+  void _sweepCached(int n, int firstGroup, int lastGroup);
+  void _buildSweepPlan(int n);
+  std::vector< std::vector<SweepPlanElement> > _sweepPlan;  //!< [n] cached orientations, in batch order
+  std::vector< std::vector<long> > _sweepBatchStart;        //!< [n] first plan entry of each batch, plus the end
+  void _gatherEdgeFlux(long neighbor, long edge, long bdryID, int n, int g,
+                       double& psiA, double& psiB);
+  void _solveVertexToEdge(TriangleDescriptorReg& tri, double theta, long elementID, int n, int g);
+  void _solveEdgeToVertex(TriangleDescriptorReg& tri, double theta, long elementID, int n, int g);
+  void _loadSource(TriangleDescriptorReg& tri, const double* source);
+  void _storeCellFlux(const TriangleDescriptorReg& tri, double* cellFlux);
   void _getTriangleOrientation(UltraLightElement &element2, int& n,
                                TriangleDescriptorReg& tri, int& blockID,
                                double& theta, int &v0, int &v1, int &v2);
-  void _applyBoundaryConditions();
-  double _getAngleFromVector(double dx, double dy);
-
-  void _calculateSource(double* fissionFlux);
-  void _getExternalSource();
-  void _addScatterSource();
-  void _calculateMatrixAction(double* x, double* y);
-  double getSubCellScalarFlux(long space_i, int group_g, int subCell);
+  void _buildBoundaryPlan();
+
+  void _addIsotropicScatterSource();
+  void _calculateCachedScalarFlux(bool activeGroupsOnly);
+
+  // Element solve, scatter source and scalar flux kernels with the number of
+  // groups (G) and directions (Q) fixed at compile time.  G or Q of 0 uses the
+  // problem value.
+  void _selectKernels();
+  template <int Q> void _selectGroupKernels();
+  template <int G, int Q> void _setKernels();
+  template <int G> void _solveElementKernel(UltraLightElement& element, long elementID, int n,
+                                            int firstGroup, int lastGroup);
+  template <int G, int Q> void _isotropicScatterSourceKernel();
+  template <int G, int Q> void _scalarFluxKernel(bool activeGroupsOnly);
+  void (SolverRegMOC::*_solveElementGroups)(UltraLightElement&, long, int, int, int);
+  void (SolverRegMOC::*_isotropicScatterSource)();
+  void (SolverRegMOC::*_cachedScalarFlux)(bool);
 
   void triangleSolveA(TriangleDescriptorReg& tri, double& phi, double& theta, double& mu, long& elementID, int& n, int& g);
   void triangleSolveB(TriangleDescriptorReg& tri, double& phi, double& theta, double& mu, long& elementID, int& n, int& g);
@@ -77,9 +113,6 @@ class SolverRegMOC : public SolverBase
                         double& psi0r, double& psi0l,
                         double& psi1, double& psi2,
                         double& psi12, double& cell);
-
-
-  unsigned int _numPhaseSpaceDOF;
 };
 
 
@@ -2,6 +2,8 @@
 #define TRANSPORTPROBLEM_H
 
 #include<vector>
+#include<map>
+#include<string>
 
 #include "meshfactory.h"
 #include "material.h"
@@ -23,6 +25,7 @@ class TransportProblem
 {
  public:
   TransportProblem(InputParser& input, MeshFactory& meshFactory, int numGroups_in);
+  TransportProblem(TransportProblem& fineProblem, int polarOrder);
   ~TransportProblem();
   MeshInterface *mesh;
   long numCells;
@@ -31,8 +34,11 @@ class TransportProblem
   int numGroups;
   int quadOrder;
   int scatterAnisotropy;
+  int sweepOrderOffset;   ///< Index of the mesh sweep ordering used for the first ordinate
+  int numSourceAngles;    ///< Number of angles stored in the source arrays (1 without a quadrature)
 
   bool hasFixedSource;
+  int numSources;         ///< Number of independent external sources (swept together if the solver can batch them)
 
   TransportBC bcLeft;
   TransportBC bcRight;
@@ -49,20 +55,40 @@ class TransportProblem
   
   std::vector<double> nxnyq;
 
+  // Incoming boundary angular flux by boundary edge, read from an HDF5 file.
+  // Edges without an entry fall back to the nxnyq boundary source.
+  std::map<long, long> boundarySourceOffset;  ///< Edge ID to offset into boundarySource
+  std::vector<double> boundarySource;         ///< Ordered by edge, angle, group
+
+  const double* getBoundarySource(long edge, int quadp, int group)
+  {
+    std::map<long, long>::iterator it = boundarySourceOffset.find(edge);
+    if (it == boundarySourceOffset.end())
+      return NULL;
+    return &boundarySource[ it->second + numGroups*quadp + group ];
+  }
+
   void putExtSource(long cell, int quadp, int group, double value)
   { extSource[ si(cell,quadp,group) ] = value; }
   double* getExtSource(long cell, int quadp, int group)
   { return &extSource[ si(cell,quadp,group) ]; }
 
+  void selectSource(int source);
+
   void putRefSolution(long cell, int quadp, int group, double value)
   { refSolution[ si(cell,quadp,group) ] = value; }
   double* getRefSolution(long cell, int quadp, int group)
   { return &refSolution[ si(cell,quadp,group) ]; }
 
  private:
+  void _generateProductQuadrature(int polarOrder, bool planar);
+  void _readBoundarySource(std::string fileName);
+
+  std::vector<double> _batchSource;   ///< All external sources read from file, by source, cell, angle
+
   // Fast, medium, slow
   // space, angle, energy
   long si(long cell, int quadp, int group)
-  { return numCells*quadOrder*group + numCells*quadp + cell; }
+  { return numCells*numSourceAngles*group + numCells*quadp + cell; }
 };
 #endif
@@ -10,7 +10,7 @@ namespace math{
 
     _polyVals = new double [_numTerms];
     _polyVals[0] = 1.0;
-    for (int i=1; i<=_numTerms; i++)
+    for (int i=1; i<_numTerms; i++)
       _polyVals[i] = 0.0;
   }
 
@@ -21,23 +21,34 @@ namespace math{
   }
 
   
+  /**
+   *  Evaluates P_l^m(x) for all degrees up to _maxDegree and orders -l..l,
+   *  without the Condon-Shortley phase
+   */
   void
   AssociatedLegendrePolynomial::evaluate(double x)
   {
     if (_maxDegree==0) return;
 
-    _polyVals[1] = 0.5*(std::sqrt(1.0 - std::pow(x,2)));
-    _polyVals[2] = x;
-    _polyVals[3] = -std::sqrt(1.0 - std::pow(x,2));
-    
-    for (int ell=2; ell<_maxDegree; ell++) {
-      for (int m=2-ell; m<ell-2; m++) {
+    double s = std::sqrt(std::fmax(1.0 - std::pow(x,2), 0.0));
+
+    // Diagonal, first off-diagonal, and then recurrence in degree
+    double pmm = 1.0;
+    for (int m=0; m<=_maxDegree; m++) {
+      if (m > 0) pmm = pmm*(2*m - 1)*s;
+      _polyVals[ _ind(m,m) ] = pmm;
+      if (m < _maxDegree)
+        _polyVals[ _ind(m+1,m) ] = x*(2*m + 1)*pmm;
+      for (int ell=m+2; ell<=_maxDegree; ell++) {
         _polyVals[ _ind(ell,m) ] = ((2*ell-1)*x*_polyVals[ _ind(ell-1,m) ] - (ell+m-1)*_polyVals[ _ind(ell-2,m) ])/(ell-m);
       }
-      _polyVals[ _ind(ell,ell) ] = -(2*ell - 1)*std::sqrt(1 - std::pow(x,2))*_polyVals[ _ind(ell-1,ell-1) ];
-      _polyVals[ _ind(ell,ell-1) ] = x*(2*ell - 1)*_polyVals[ _ind(ell-1,ell-1) ];
-      _polyVals[ _ind(ell,1-ell) ] = std::pow(-1,ell-1)/factorial(2*ell-1)*_polyVals[ _ind(ell,ell-1) ];
-      _polyVals[ _ind(ell,-ell) ] = std::pow(-1,ell)/factorial(2*ell)*_polyVals[ _ind(ell,ell) ];
+    }
+
+    // Negative orders
+    for (int ell=1; ell<=_maxDegree; ell++) {
+      for (int m=1; m<=ell; m++) {
+        _polyVals[ _ind(ell,-m) ] = std::pow(-1.0,m)*factorial(ell-m)/double(factorial(ell+m))*_polyVals[ _ind(ell,m) ];
+      }
     }
   }
   
@@ -0,0 +1,50 @@
+#include "eigenvalue.h"
+#include "log.h"
+
+
+Eigenvalue::Eigenvalue(InputParser& input)
+  : SolutionManager(SolutionManager::Eigenvalue, input)
+{
+  std::vector<std::string> path(1,"Eigenvalue");
+  std::vector<double> v;
+
+  v = input.getVector(path, "initialGuess");
+  if (v.size() > 0)
+    solver->criticalEigenvalue = v[0];
+
+  _stateFileName = input.getString(path, "stateFile");
+  if (_stateFileName == "empty")
+    _stateFileName = "state";
+
+  if (_transportProblem->hasFixedSource)
+    LOG_WARN("Fixed source in input is being ignored!!!");
+  solver->eigenvalueMode = true;
+  solver->sourceConfig.hasExternalSource = false;
+  solver->sourceConfig.hasScatterSource = true;
+  solver->sourceConfig.hasFissionSource = true;
+  solver->sourceConfig.hasTransientSource = false;
+}
+
+Eigenvalue::~Eigenvalue()
+{
+}
+
+void
+Eigenvalue::execute()
+{
+  _solveWithWarmStart();
+  LOG("Eigenvalue = ", solver->criticalEigenvalue);
+
+  _saveSolutionState();
+}
+
+void
+Eigenvalue::_saveSolutionState()
+{
+  // Normalize to a total production rate of k, consistent with transient ICs
+  solver->normalizeSolution(solver->criticalEigenvalue);
+  _output->writeData("k", &solver->criticalEigenvalue, 1);
+  solver->writeSolution(_output);
+  solver->writeScalarFlux(_output);
+  _dumpBaseSolution(_stateFileName);
+}
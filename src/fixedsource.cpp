@@ -1,6 +1,12 @@
 #include "fixedsource.h"
+#include "moabmesh.h"
+#include "hdf5interface.h"
+#include "perfstats.h"
 #include "log.h"
 
+#include <sstream>
+#include <fstream>
+
 
 FixedSource::FixedSource(InputParser& input)
   : SolutionManager(SolutionManager::FixedSource, input)
@@ -9,6 +15,10 @@ FixedSource::FixedSource(InputParser& input)
   solver->sourceConfig.hasScatterSource = true;
   solver->sourceConfig.hasFissionSource = true;
   solver->sourceConfig.hasTransientSource = false;
+
+  std::vector<std::string> path(1,"FixedSource");
+  _responseCacheName = input.getString(path, "responseCache");
+  _responseCoefficients = input.getVector(path, "responseCoefficients");
 }
 
 FixedSource::~FixedSource()
@@ -23,9 +33,45 @@ FixedSource::execute()
     return;
   }
   
-  solver->solve();
+  if (_responseCacheName != "empty") {
+    if (_isLinearInSource()) {
+      _solveWithResponseCache();
+      return;
+    }
+    LOG_WARN("The problem is not linear in the external source; the response cache is not used.");
+  }
 
-  _saveSolutionState();
+  if (_transportProblem->numSources == 1) {
+    _solveWithWarmStart();
+    _saveSolutionState();
+    return;
+  }
+
+  // The sources are swept together if the solver can batch them (it starts
+  // them cold).  Otherwise they are solved one after another and only the
+  // solver setup (boundary condition plan, sweep orderings, etc.) is shared.
+  // Each source gets its own scalar and boundary flux output.
+  int numSources = _transportProblem->numSources;
+  if (solver->setBatchedSources(numSources)) {
+    solver->zeroSolution();
+    solver->solve();
+    for (int k=0; k<numSources; k++) {
+      solver->selectBatchedSource(k);
+      _saveSourceFlux(k);
+    }
+    solver->selectBatchedSource(0);
+  }
+  else {
+    for (int k=0; k<numSources; k++) {
+      LOG("Solving for external source ", k+1, " of ", numSources);
+      _transportProblem->selectSource(k);
+      solver->zeroSolution();
+      _solveWithWarmStart();
+      _saveSourceFlux(k);
+    }
+  }
+  // The solution record (DOF count and partition) does not depend on the source
+  solver->writeSolution(_output);
 }
 
 void
@@ -33,4 +79,249 @@ FixedSource::_saveSolutionState()
 {
   solver->writeSolution(_output);
   solver->writeScalarFlux(_output);
+  solver->writeBoundaryFlux(_output);
+}
+
+/// Write the scalar and boundary flux of external source k (of several)
+void
+FixedSource::_saveSourceFlux(int k)
+{
+  std::ostringstream suffix;
+  suffix << "_src" << k+1;
+  solver->writeScalarFlux(_output, suffix.str());
+  solver->writeBoundaryFlux(_output, suffix.str());
+}
+
+/**
+ *  The solution is linear in the external source if there is no fission and
+ *  no (inhomogeneous) boundary source
+ */
+bool
+FixedSource::_isLinearInSource()
+{
+  if (_transportProblem->globalBC == source)
+    return false;
+
+  for (long i=0; i<_transportProblem->numCells; i++) {
+    Material* mat = _transportProblem->mesh->getElementMat(i);
+    for (int g=0; g<_transportProblem->numGroups; g++)
+      if (*mat->getNuSigma_f(g+1) != 0.0)
+        return false;
+  }
+  return true;
+}
+
+/// Solve using (or filling) the response function cache
+/**
+ *  Each external source is treated as a basis.  If the cache holds the
+ *  responses for this problem they are read, otherwise each basis is solved
+ *  and the responses are cached.  With responseCoefficients, the scalar flux
+ *  of the corresponding combination of the bases is written; otherwise the
+ *  response to each basis is written.
+ */
+void
+FixedSource::_solveWithResponseCache()
+{
+  PerfStats X("FixedSource::_solveWithResponseCache");
+
+  long numCells = _transportProblem->numCells;
+  int numGroups = _transportProblem->numGroups;
+  long responseSize = numCells*numGroups;
+
+  int key[2];
+  _computeCacheKey(key);
+
+  int numBases;
+  std::vector<double> responses;
+  if (_readResponseCache(key, numBases, responses)) {
+    LOG("Using ", numBases, " cached responses from ", _responseCacheName);
+  }
+  else {
+    numBases = _transportProblem->numSources;
+    responses.resize(numBases*responseSize);
+    bool batched = solver->setBatchedSources(numBases);
+    if (batched) {
+      solver->zeroSolution();
+      solver->solve();
+    }
+    for (int k=0; k<numBases; k++) {
+      if (batched) {
+        solver->selectBatchedSource(k);
+      }
+      else {
+        LOG("Calculating response to source ", k+1, " of ", numBases);
+        _transportProblem->selectSource(k);
+        solver->zeroSolution();
+        _solveWithWarmStart();
+      }
+      for (int g=0; g<numGroups; g++)
+        for (long i=0; i<numCells; i++)
+          responses[k*responseSize + g*numCells + i] = solver->getScalarFlux(i,g);
+    }
+    if (batched)
+      solver->selectBatchedSource(0);
+    _writeResponseCache(key, numBases, responses);
+  }
+
+  if (_responseCoefficients.size() == 0) {
+    for (int k=0; k<numBases; k++) {
+      std::ostringstream suffix;
+      suffix << "_src" << k+1;
+      _writeScalarFlux(&responses[k*responseSize], suffix.str());
+    }
+    return;
+  }
+
+  if (_responseCoefficients.size() != numBases) {
+    LOG_ERR("Found ", _responseCoefficients.size(), " response coefficients for ", numBases, " bases.");
+    return;
+  }
+
+  std::vector<double> flux(responseSize, 0.0);
+  for (int k=0; k<numBases; k++)
+    for (long j=0; j<responseSize; j++)
+      flux[j] += _responseCoefficients[k]*responses[k*responseSize + j];
+  _writeScalarFlux(&flux[0], "");
+}
+
+/// Running FNV-1a hash of a block of data
+static void
+hashData(unsigned long long& hash, const void* data, size_t size)
+{
+  const unsigned char* bytes = (const unsigned char*)data;
+  for (size_t b=0; b<size; b++) {
+    hash ^= bytes[b];
+    hash *= 1099511628211ULL;
+  }
+}
+
+/**
+ *  Key identifying the responses: a hash of the solver type and tolerance,
+ *  the mesh geometry, materials (all scattering moments), angular quadrature,
+ *  boundary conditions and basis sources
+ */
+void
+FixedSource::_computeCacheKey(int* key)
+{
+  TransportProblem& prob = *_transportProblem;
+  unsigned long long hash = 14695981039346656037ULL;
+
+  hashData(hash, &prob.numCells, sizeof(prob.numCells));
+  hashData(hash, &prob.numGroups, sizeof(prob.numGroups));
+  hashData(hash, &prob.globalBC, sizeof(prob.globalBC));
+  hashData(hash, &prob.scatterAnisotropy, sizeof(prob.scatterAnisotropy));
+
+  // Responses of another method or a looser tolerance are not reused
+  std::vector<std::string> solverPath(1,"Solver");
+  std::string solverType = _input.getString(solverPath, "type");
+  hashData(hash, solverType.c_str(), solverType.size());
+  std::vector<double> tolerance = _input.getVector(solverPath, "rInfTolerance");
+  if (tolerance.size() > 0)
+    hashData(hash, &tolerance[0], tolerance.size()*sizeof(double));
+
+  MoabMesh* moabMesh = dynamic_cast<MoabMesh*>(prob.mesh);
+  for (long i=0; i<prob.numCells; i++) {
+    if (moabMesh) {
+      UltraLightElement element;
+      moabMesh->getCurrentElementFromID(i, element);
+      hashData(hash, element.x, sizeof(element.x));
+      hashData(hash, element.y, sizeof(element.y));
+    }
+    else {
+      double volume = prob.mesh->getElementVolume(i);
+      hashData(hash, &volume, sizeof(volume));
+    }
+
+    Material* mat = prob.mesh->getElementMat(i);
+    hashData(hash, &mat->scatteringOrder, sizeof(mat->scatteringOrder));
+    for (int g=0; g<prob.numGroups; g++) {
+      hashData(hash, mat->getSigma_t(g+1), sizeof(double));
+      for (int gp=0; gp<prob.numGroups; gp++)
+        for (int l=0; l<=mat->scatteringOrder; l++)
+          hashData(hash, mat->getSigma_s(gp+1,g+1,l), sizeof(double));
+    }
+  }
+
+  if (prob.quadOrder > 0) {
+    hashData(hash, &prob.omega_x[0], prob.quadOrder*sizeof(double));
+    hashData(hash, &prob.omega_y[0], prob.quadOrder*sizeof(double));
+    hashData(hash, &prob.omega_z[0], prob.quadOrder*sizeof(double));
+    hashData(hash, &prob.weights[0], prob.quadOrder*sizeof(double));
+  }
+
+  long sourceSize = prob.numCells*prob.numSourceAngles*prob.numGroups;
+  for (int k=0; k<prob.numSources; k++) {
+    prob.selectSource(k);
+    hashData(hash, prob.getExtSource(0,0,0), sourceSize*sizeof(double));
+  }
+
+  key[0] = int(hash & 0xffffffffULL);
+  key[1] = int(hash >> 32);
+}
+
+/**
+ *  Read the cached responses.  Returns false if there is no cache file or it
+ *  was made for a different problem.
+ */
+bool
+FixedSource::_readResponseCache(int* key, int& numBases, std::vector<double>& responses)
+{
+  std::ifstream cacheFile((_responseCacheName + ".h5").c_str());
+  if (!cacheFile.good())
+    return false;
+  cacheFile.close();
+
+  HDF5Interface h5;
+  h5.open(_responseCacheName, 'R');
+  HDFDataStruct<int> cachedKey;
+  cachedKey.data = h5.readData(_responseCacheName, "/cacheKey");
+  bool match = (cachedKey[0] == key[0] && cachedKey[1] == key[1]);
+  cachedKey.clear();
+
+  if (match) {
+    HDFDataStruct<int> cachedBases;
+    cachedBases.data = h5.readData(_responseCacheName, "/numBases");
+    numBases = cachedBases[0];
+    cachedBases.clear();
+
+    HDFDataStruct<double> cachedResponses;
+    cachedResponses.data = h5.readData(_responseCacheName, "/response");
+    responses.assign(cachedResponses.getData(), cachedResponses.getData() + cachedResponses.data->dims[0]);
+    cachedResponses.clear();
+  }
+  else {
+    LOG("Response cache ", _responseCacheName, " is for a different problem and will be replaced.");
+  }
+  h5.close(_responseCacheName);
+
+  return match;
+}
+
+void
+FixedSource::_writeResponseCache(int* key, int numBases, std::vector<double>& responses)
+{
+  Output* cacheFile = new Output(_responseCacheName, Output::HDF5);
+  cacheFile->writeData("cacheKey", key, 2);
+  cacheFile->writeData("numBases", &numBases, 1);
+  cacheFile->writeData("response", &responses[0], responses.size());
+  delete cacheFile;
+  LOG("Wrote ", numBases, " responses to ", _responseCacheName);
+}
+
+/**
+ *  Write a scalar flux (ordered by group, cell) in the same way as
+ *  SolverBase::writeScalarFlux
+ */
+void
+FixedSource::_writeScalarFlux(double* flux, std::string suffix)
+{
+  for (int g=0; g<_transportProblem->numGroups; g++) {
+    std::ostringstream varName;
+    varName << "scalarFlux_" << g+1 << suffix;
+    if (_output->outputFormat & Output::MESH) {
+      _transportProblem->mesh->tagMesh(varName.str(), &flux[g*_transportProblem->numCells],
+                                       _transportProblem->numCells);
+      _transportProblem->mesh->writeMesh(_output);
+    }
+  }
 }
@@ -20,7 +20,9 @@
 #include "transient_ndadaptive.h"
 #include "transient_uts.h"
 #include "fixedsource.h"
+#include "eigenvalue.h"
 #include "perfstats.h"
+#include "parallel.h"
 #include "log.h"
 
 #ifdef _OPENMP
@@ -29,9 +31,12 @@
 
 int main(int argc, char* argv[])
 {
+  Parallel::initialize(&argc, &argv);
+
   std::cout << "RADIATION TRANSPORT CODE" << std::endl;
   if (argc != 2) {
     std::cerr << "Usage: " << argv[0] << " input.file" << std::endl;
+    Parallel::finalize();
     return 0;
   }
 
@@ -54,6 +59,7 @@ int main(int argc, char* argv[])
   if (!parseResult) {
     LOG_ERR("Parse failure.");
     input.echoInput();
+    Parallel::finalize();
     return 1;
   }
   input.echoInput();
@@ -82,8 +88,13 @@ int main(int argc, char* argv[])
     LOG("Fixed source problem detected.");
     solution = new FixedSource(input);
   }
+  else if (input.countSets(path = std::vector<std::string>(1,"Eigenvalue")) > 0) {
+    LOG("Eigenvalue problem detected.");
+    solution = new Eigenvalue(input);
+  }
   else {
     LOG_ERR("No suitable solution manager found.");
+    Parallel::finalize();
     return 1;
   }
 
@@ -106,6 +117,7 @@ int main(int argc, char* argv[])
   PerfStats::display();
 
   LOG("Complete.");
+  Parallel::finalize();
 }
 
 
@@ -98,7 +98,7 @@ Material::putSigma_s(std::vector<double>& crossSection)
     for (unsigned int groupOut=1; groupOut<=numGroups; groupOut++) {
       for (unsigned int groupIn=1; groupIn<=numGroups; groupIn++) {
         _sigma_s_ker[ si(groupIn, groupOut, order) ]
-          = crossSection[ (groupOut-1)*numGroups + groupIn - 1];
+          = crossSection[ order*numGroups*numGroups + (groupOut-1)*numGroups + groupIn - 1];
         if (order==0) _sigma_s[groupIn-1] += crossSection[ (groupOut-1)*numGroups + groupIn - 1];
       }
     }
@@ -184,7 +184,14 @@ MaterialFactory::readNextMaterial(InputParser& input, int matNum)
   }
   int block = int (v[0]);
 
-  Material* mat1 = createNewMaterial(matName, (unsigned int)block,  (unsigned int)numGroups, 0 );
+  // Legendre order of the scattering matrix; sigmaS then holds the G x G
+  // matrices of orders 0, 1, ..., one after another
+  int scatteringOrder = 0;
+  v = input.getVector(path, "scatteringOrder", matNum);
+  if (v.size() > 0)
+    scatteringOrder = int (v[0]);
+
+  Material* mat1 = createNewMaterial(matName, (unsigned int)block,  (unsigned int)numGroups, (unsigned int)scatteringOrder );
 
   
   v = input.getVector(path, "sigmaT", matNum);
@@ -2,6 +2,9 @@
 #include "moab/AdaptiveKDTree.hpp"
 #include "global.h"
 
+#include <deque>
+#include <algorithm>
+
 MoabMesh::MoabMesh()
   : MeshInterface()
 {
@@ -170,6 +173,7 @@ MoabMesh::readMeshSweepOrder(const std::string fileName)
 
   _orderedMeshSet.reserve(nAngles);
   _orderedMeshSet.resize(nAngles);
+  _createdSweepOrders.clear();
 
   // Create sweep ordering array (need to make sure this gets deallocated somehwere)
   for (int j=0; j<nAngles; j++) {
@@ -184,6 +188,105 @@ MoabMesh::readMeshSweepOrder(const std::string fileName)
 }
 
 
+/// Create upwind sweep orderings for a set of directions
+/**
+ *  For each direction (omega_x, omega_y) the elements are topologically sorted
+ *  so that every element follows its upwind neighbors.  A dependency cycle, if
+ *  any, is broken at the remaining element that is furthest upwind.  The new
+ *  ordered mesh sets are appended after any existing ones (e.g., read from a
+ *  file); the index of the first new set is returned.  Orderings created
+ *  earlier for the same directions (e.g., by the coarse problems of every
+ *  quadrature continuation) are reused rather than created again.
+ */
+int
+MoabMesh::createMeshSweepOrder(const std::vector<double>& omega_x, const std::vector<double>& omega_y)
+{
+  std::vector<double> directions(omega_x);
+  directions.insert(directions.end(), omega_y.begin(), omega_y.end());
+  std::map<std::vector<double>, int>::iterator cached = _createdSweepOrders.find(directions);
+  if (cached != _createdSweepOrders.end())
+    return cached->second;
+
+  int nxtNghbr[3] = {1, 2, 0};
+  int firstSet = _orderedMeshSet.size();
+  int nAngles = omega_x.size();
+  _createdSweepOrders[directions] = firstSet;
+
+  std::vector<UltraLightElement> elements(_numElements);
+  std::vector<double> xc(_numElements), yc(_numElements);
+  for (long i=0; i<_numElements; i++) {
+    getCurrentElementFromID(i, elements[i]);
+    xc[i] = (elements[i].x[0] + elements[i].x[1] + elements[i].x[2])/3.0;
+    yc[i] = (elements[i].y[0] + elements[i].y[1] + elements[i].y[2])/3.0;
+  }
+
+  _orderedMeshSet.resize(firstSet + nAngles);
+  for (int n=0; n<nAngles; n++) {
+    // Build the downwind graph
+    std::vector<int> numUpwind(_numElements, 0);
+    std::vector<long> downwind(3*_numElements, -1);
+    for (long i=0; i<_numElements; i++) {
+      UltraLightElement& elem = elements[i];
+      for (int v=0; v<3; v++) {
+        if (elem.neighborID[v] < 0) continue;
+        int vn = nxtNghbr[v];
+        double nx = elem.y[vn] - elem.y[v];
+        double ny = elem.x[v] - elem.x[vn];
+        // Make the normal point out of the element
+        if (nx*(0.5*(elem.x[v]+elem.x[vn]) - xc[i]) + ny*(0.5*(elem.y[v]+elem.y[vn]) - yc[i]) < 0.0) {
+          nx = -nx;
+          ny = -ny;
+        }
+        if (omega_x[n]*nx + omega_y[n]*ny > 0.0) {
+          downwind[3*i + v] = elem.neighborID[v];
+          numUpwind[elem.neighborID[v]]++;
+        }
+      }
+    }
+
+    // Kahn's algorithm
+    std::deque<long> ready;
+    for (long i=0; i<_numElements; i++)
+      if (numUpwind[i] == 0) ready.push_back(i);
+
+    std::vector<bool> done(_numElements, false);
+    long numDone = 0;
+    _mb->create_meshset(moab::MESHSET_ORDERED, _orderedMeshSet[firstSet + n]);
+    while (numDone < _numElements) {
+      if (ready.empty()) {
+        LOG_WARN("Sweep dependency cycle found for direction ", n, "; lagging the cycle.");
+        long upwindMost = -1;
+        for (long i=0; i<_numElements; i++) {
+          if (done[i]) continue;
+          if (upwindMost < 0 ||
+              omega_x[n]*xc[i] + omega_y[n]*yc[i] < omega_x[n]*xc[upwindMost] + omega_y[n]*yc[upwindMost])
+            upwindMost = i;
+        }
+        ready.push_back(upwindMost);
+      }
+
+      long i = ready.front();
+      ready.pop_front();
+      if (done[i]) continue;
+      done[i] = true;
+      numDone++;
+
+      moab::EntityHandle entity;
+      _mb->handle_from_id(moab::MBTRI, i+1, entity);
+      _mb->add_entities(_orderedMeshSet[firstSet + n], &entity, 1);
+
+      for (int v=0; v<3; v++) {
+        long nghbr = downwind[3*i + v];
+        if (nghbr >= 0 && --numUpwind[nghbr] == 0)
+          ready.push_back(nghbr);
+      }
+    }
+  }
+
+  LOG_DBG("Created sweep orderings for ", nAngles, " directions.");
+  return firstSet;
+}
+
 long
 MoabMesh::queryPointLocation( double* point)
 {
@@ -240,6 +343,9 @@ MoabMesh::queryPointLocation( double* point)
 void
 MoabMesh::writeMesh(Output* outputFile)
 {
+  if (!(outputFile->outputFormat & Output::MESH))
+    return;
+
   std::string fileName = outputFile->getName();
   fileName.append(".vtk");
 
@@ -279,6 +385,154 @@ MoabMesh::tagMesh(std::string tagName, double* tagDataBuffer, long tagSize)
 }
 
 
+/// Spatial decomposition into numParts subdomains
+/**
+ *  The element dual graph is split by recursive bisection.  Each bisection
+ *  cuts the element set at the weighted median of its centroids along the
+ *  longer coordinate extent (recursive coordinate bisection) and, if refine
+ *  is set, then moves elements across the cut with a greedy
+ *  Fiduccia-Mattheyses pass to reduce the number of cut edges while keeping
+ *  the two sides balanced.  Part sizes follow the element weights (uniform if
+ *  none are given).
+ *
+ *  The part of each element is stored in elementPartition and as the
+ *  "partition" mesh tag.
+ */
+void
+MoabMesh::partitionMesh(int numParts, bool refine, const std::vector<double>& weights)
+{
+  std::vector<double> w = weights;
+  if (w.size() != _numElements)
+    w.assign(_numElements, 1.0);
+
+  std::vector<double> xc(_numElements), yc(_numElements);
+  std::vector<long> neighbors(3*_numElements);
+  UltraLightElement element;
+  for (long i=0; i<_numElements; i++) {
+    getCurrentElementFromID(i, element);
+    xc[i] = (element.x[0] + element.x[1] + element.x[2])/3.0;
+    yc[i] = (element.y[0] + element.y[1] + element.y[2])/3.0;
+    for (int v=0; v<3; v++)
+      neighbors[3*i + v] = element.neighborID[v];
+  }
+
+  std::vector<long> elements(_numElements);
+  for (long i=0; i<_numElements; i++)
+    elements[i] = i;
+  elementPartition.assign(_numElements, 0);
+  _bisectPartition(elements, 0, numParts, refine, w, xc, yc, neighbors);
+
+  // Partition quality
+  long cutEdges = 0;
+  std::vector<double> partWeight(numParts, 0.0);
+  for (long i=0; i<_numElements; i++) {
+    partWeight[elementPartition[i]] += w[i];
+    for (int v=0; v<3; v++) {
+      long j = neighbors[3*i + v];
+      if (j > i && elementPartition[j] != elementPartition[i])
+        cutEdges++;
+    }
+  }
+  double totalWeight = 0.0, maxWeight = 0.0;
+  for (int p=0; p<numParts; p++) {
+    totalWeight += partWeight[p];
+    maxWeight = std::max(maxWeight, partWeight[p]);
+  }
+  LOG("Partitioned the mesh into ", numParts, " parts with ", cutEdges,
+      " interface edges and a load imbalance of ", maxWeight*numParts/totalWeight, ".");
+
+  std::vector<double> tagBuffer(elementPartition.begin(), elementPartition.end());
+  tagMesh("partition", &tagBuffer[0], _numElements);
+}
+
+/**
+ *  Split elements (all labeled firstPart in elementPartition) into parts
+ *  firstPart, ..., firstPart+numParts-1.  Labels of this range are only held
+ *  by these elements, which identifies the neighbors inside the set.
+ */
+void
+MoabMesh::_bisectPartition(std::vector<long>& elements, int firstPart, int numParts, bool refine,
+                           const std::vector<double>& weights,
+                           const std::vector<double>& xc, const std::vector<double>& yc,
+                           const std::vector<long>& neighbors)
+{
+  if (numParts == 1 || elements.size() == 0)
+    return;
+
+  int leftParts = numParts/2;
+  int left = firstPart;
+  int right = firstPart + leftParts;
+
+  // Cut along the longer extent at the weighted median
+  double xmin = xc[elements[0]], xmax = xmin, ymin = yc[elements[0]], ymax = ymin;
+  double totalWeight = 0.0, maxElementWeight = 0.0;
+  for (long k=0; k<elements.size(); k++) {
+    long i = elements[k];
+    xmin = std::min(xmin, xc[i]);  xmax = std::max(xmax, xc[i]);
+    ymin = std::min(ymin, yc[i]);  ymax = std::max(ymax, yc[i]);
+    totalWeight += weights[i];
+    maxElementWeight = std::max(maxElementWeight, weights[i]);
+  }
+  const std::vector<double>& coord = (xmax - xmin >= ymax - ymin) ? xc : yc;
+  std::vector< std::pair<double, long> > sorted(elements.size());
+  for (long k=0; k<elements.size(); k++)
+    sorted[k] = std::make_pair(coord[elements[k]], elements[k]);
+  std::sort(sorted.begin(), sorted.end());
+
+  double targetWeight = totalWeight*leftParts/numParts;
+  double leftWeight = 0.0;
+  for (long k=0; k<sorted.size(); k++) {
+    long i = sorted[k].second;
+    if (leftWeight < targetWeight) {
+      elementPartition[i] = left;
+      leftWeight += weights[i];
+    }
+    else {
+      elementPartition[i] = right;
+    }
+  }
+
+  // Greedy boundary refinement
+  if (refine) {
+    double tolerance = std::max(maxElementWeight, 0.02*totalWeight);
+    for (int pass=0; pass<10; pass++) {
+      long moves = 0;
+      for (long k=0; k<elements.size(); k++) {
+        long i = elements[k];
+        int side = elementPartition[i];
+        int other = (side == left) ? right : left;
+        int gain = 0;
+        for (int v=0; v<3; v++) {
+          long j = neighbors[3*i + v];
+          if (j < 0) continue;
+          if (elementPartition[j] == other) gain++;
+          else if (elementPartition[j] == side) gain--;
+        }
+        if (gain <= 0) continue;
+        double newLeftWeight = leftWeight + ((side == left) ? -weights[i] : weights[i]);
+        if (std::abs(newLeftWeight - targetWeight) > tolerance) continue;
+        elementPartition[i] = other;
+        leftWeight = newLeftWeight;
+        moves++;
+      }
+      if (moves == 0) break;
+    }
+  }
+
+  std::vector<long> leftElements, rightElements;
+  for (long k=0; k<elements.size(); k++) {
+    if (elementPartition[elements[k]] == left)
+      leftElements.push_back(elements[k]);
+    else
+      rightElements.push_back(elements[k]);
+  }
+  elements.clear();
+
+  _bisectPartition(leftElements, left, leftParts, refine, weights, xc, yc, neighbors);
+  _bisectPartition(rightElements, right, numParts - leftParts, refine, weights, xc, yc, neighbors);
+}
+
+
 void
 MoabMesh::logMemoryUse()
 {
@@ -1,4 +1,5 @@
 #include "output.h"
+#include "parallel.h"
 
 #include<sstream>
 #include<vector>
@@ -6,6 +7,10 @@
 Output::Output(std::string fileName, int format) :
   outputFormat(format), outputFileName(fileName), solutionPoint(0)
 {
+  // Only the root rank writes output files
+  if (!Parallel::isRoot())
+    outputFormat = format = 0;
+
   if ( format & ASCII )
     outputFile.open(outputFileName);
 
@@ -0,0 +1,234 @@
+#include "parallel.h"
+#include "log.h"
+
+#include <sstream>
+#include <fstream>
+#include <cstdlib>
+#include <algorithm>
+
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+int Parallel::_rank = 0;
+int Parallel::_size = 1;
+
+void
+Parallel::initialize(int* argc, char*** argv)
+{
+#ifdef USE_MPI
+  MPI_Init(argc, argv);
+  MPI_Comm_rank(MPI_COMM_WORLD, &_rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &_size);
+
+  // Only the root rank writes to the main log
+  if (_rank > 0) {
+    std::stringstream logName;
+    logName << "output_rank" << _rank << ".log";
+    logInstance.reopen(logName.str());
+  }
+  if (_size > 1)
+    LOG("Running on ", _size, " MPI ranks (this is rank ", _rank, ").");
+#endif
+}
+
+void
+Parallel::finalize()
+{
+#ifdef USE_MPI
+  MPI_Finalize();
+#endif
+}
+
+double
+Parallel::sumAll(double value)
+{
+#ifdef USE_MPI
+  if (_size > 1)
+    MPI_Allreduce(MPI_IN_PLACE, &value, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+#endif
+  return value;
+}
+
+double
+Parallel::maxAll(double value)
+{
+#ifdef USE_MPI
+  if (_size > 1)
+    MPI_Allreduce(MPI_IN_PLACE, &value, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+#endif
+  return value;
+}
+
+void
+Parallel::sumAll(double* data, long size)
+{
+#ifdef USE_MPI
+  if (_size > 1)
+    MPI_Allreduce(MPI_IN_PLACE, data, size, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+#endif
+}
+
+void
+Parallel::maxAll(double* data, long size)
+{
+#ifdef USE_MPI
+  if (_size > 1)
+    MPI_Allreduce(MPI_IN_PLACE, data, size, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+#endif
+}
+
+/// Nonblocking point-to-point exchange with a set of neighbor ranks
+/**
+ *  sendBuffers[k] is sent to ranks[k] and recvBuffers[k] (already sized by the
+ *  caller) is filled from ranks[k].
+ */
+void
+Parallel::exchange(const std::vector<int>& ranks,
+                   std::vector< std::vector<double> >& sendBuffers,
+                   std::vector< std::vector<double> >& recvBuffers)
+{
+#ifdef USE_MPI
+  int numNeighbors = ranks.size();
+  std::vector<MPI_Request> requests(2*numNeighbors);
+  for (int k=0; k<numNeighbors; k++)
+    MPI_Irecv(recvBuffers[k].data(), recvBuffers[k].size(), MPI_DOUBLE, ranks[k], 0,
+              MPI_COMM_WORLD, &requests[k]);
+  for (int k=0; k<numNeighbors; k++)
+    MPI_Isend(sendBuffers[k].data(), sendBuffers[k].size(), MPI_DOUBLE, ranks[k], 0,
+              MPI_COMM_WORLD, &requests[numNeighbors + k]);
+  MPI_Waitall(2*numNeighbors, requests.data(), MPI_STATUSES_IGNORE);
+#endif
+}
+
+/// CPUs of each NUMA node (a single node of all CPUs if unknown)
+std::vector< std::vector<int> >
+Parallel::_numaNodeCPUs()
+{
+  std::vector< std::vector<int> > nodes;
+#ifdef __linux__
+  for (int node=0; ; node++) {
+    std::stringstream fileName;
+    fileName << "/sys/devices/system/node/node" << node << "/cpulist";
+    std::ifstream cpuList(fileName.str().c_str());
+    if (!cpuList.good())
+      break;
+
+    // Ranges such as "0-15,32-47"
+    std::vector<int> cpus;
+    std::string range;
+    while (std::getline(cpuList, range, ',')) {
+      size_t dash = range.find('-');
+      int first = std::atoi(range.substr(0, dash).c_str());
+      int last = (dash == std::string::npos) ? first : std::atoi(range.substr(dash+1).c_str());
+      for (int cpu=first; cpu<=last; cpu++)
+        cpus.push_back(cpu);
+    }
+    nodes.push_back(cpus);
+  }
+  if (nodes.size() == 0) {
+    cpu_set_t allowed;
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    nodes.resize(1);
+    for (int cpu=0; cpu<CPU_SETSIZE; cpu++)
+      if (CPU_ISSET(cpu, &allowed))
+        nodes[0].push_back(cpu);
+  }
+#endif
+  return nodes;
+}
+
+/// Bind each thread to one CPU
+/**
+ *  "compact" fills the CPUs available to this rank in order, so neighboring
+ *  threads share a NUMA node; "scatter" alternates between NUMA nodes.  Only
+ *  CPUs in the rank's affinity mask are used, so ranks bound by the MPI
+ *  launcher keep to their own CPUs.  Must be called before the solver arrays
+ *  are first touched.
+ */
+void
+Parallel::pinThreads(const std::string& policy)
+{
+  if (policy != "compact" && policy != "scatter") {
+    LOG_ERR("Invalid thread affinity: ", policy);
+    return;
+  }
+#if defined(__linux__) && defined(_OPENMP)
+  cpu_set_t allowed;
+  sched_getaffinity(0, sizeof(allowed), &allowed);
+  std::vector< std::vector<int> > nodes = _numaNodeCPUs();
+  for (int k=0; k<nodes.size(); k++) {
+    std::vector<int> cpus;
+    for (int c=0; c<nodes[k].size(); c++)
+      if (CPU_ISSET(nodes[k][c], &allowed))
+        cpus.push_back(nodes[k][c]);
+    nodes[k] = cpus;
+  }
+
+  std::vector<int> order;
+  if (policy == "compact") {
+    for (int k=0; k<nodes.size(); k++)
+      order.insert(order.end(), nodes[k].begin(), nodes[k].end());
+  }
+  else {
+    int maxNodeCPUs = 0;
+    for (int k=0; k<nodes.size(); k++)
+      maxNodeCPUs = std::max(maxNodeCPUs, (int)nodes[k].size());
+    for (int c=0; c<maxNodeCPUs; c++)
+      for (int k=0; k<nodes.size(); k++)
+        if (c < nodes[k].size())
+          order.push_back(nodes[k][c]);
+  }
+  if (order.size() == 0)
+    return;
+
+  #pragma omp parallel
+  {
+    cpu_set_t cpu;
+    CPU_ZERO(&cpu);
+    CPU_SET(order[omp_get_thread_num() % order.size()], &cpu);
+    sched_setaffinity(0, sizeof(cpu), &cpu);
+  }
+  if (omp_get_max_threads() > order.size())
+    LOG_WARN("More threads (", omp_get_max_threads(), ") than CPUs (", order.size(), "); threads share CPUs.");
+#else
+  LOG_WARN("Thread affinity is not supported on this platform; threads are not pinned.");
+#endif
+}
+
+/// Log the NUMA topology and the CPU each thread currently runs on
+void
+Parallel::reportThreadPlacement()
+{
+  std::vector< std::vector<int> > nodes = _numaNodeCPUs();
+  int numThreads = 1;
+#ifdef _OPENMP
+  numThreads = omp_get_max_threads();
+#endif
+  std::vector<int> threadCPU(numThreads, -1);
+#if defined(__linux__) && defined(_OPENMP)
+  #pragma omp parallel
+  threadCPU[omp_get_thread_num()] = sched_getcpu();
+#endif
+
+  LOG(numThreads, " threads on a node with ", nodes.size(), " NUMA nodes.");
+  for (int k=0; k<nodes.size(); k++) {
+    std::stringstream threads;
+    int count = 0;
+    for (int t=0; t<numThreads; t++) {
+      for (int c=0; c<nodes[k].size(); c++) {
+        if (nodes[k][c] == threadCPU[t]) {
+          threads << " " << t;
+          count++;
+        }
+      }
+    }
+    LOG("  NUMA node ", k, ": ", nodes[k].size(), " CPUs, ", count, " threads", (count ? ":" : ""), threads.str());
+  }
+}
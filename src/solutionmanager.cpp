@@ -1,11 +1,13 @@
 #include "solutionmanager.h"
 #include "solverlocalmoc.h"
 #include "solverregmoc.h"
+#include "solverdiffusion.h"
 #include "timing.h"
 #include "material.h"
 #include "mesh.h"
 #include "transportproblem.h"
 #include "log.h"
+#include "parallel.h"
 
 #include <vector>
 #include <string>
@@ -25,32 +27,263 @@ SolutionManager::SolutionManager(ProblemType problemType, InputParser& input)
   // Form the transport problem
   _transportProblem = new TransportProblem(input, meshFactory, numGroups);
 
+  // Scattering anisotropy is the highest Legendre order of any material
+  for (std::map<unsigned int, Material*>::iterator it=MaterialFactory::_materialID.begin();
+       it!=MaterialFactory::_materialID.end();
+       ++it) {
+    if (it->second->scatteringOrder > _transportProblem->scatterAnisotropy)
+      _transportProblem->scatterAnisotropy = it->second->scatteringOrder;
+  }
+  if (_transportProblem->scatterAnisotropy > 0)
+    LOG("Using P", _transportProblem->scatterAnisotropy, " anisotropic scattering.");
+
   // Setup the output
   _output = new Output("output", Output::ASCII | Output::HDF5 | Output::MESH);
 
-  
+  std::vector<std::string> path(1,"Solver");
+
+  // Threads are pinned before any solver array is first touched
+  std::string threadAffinity = _input.getString(path, "threadAffinity");
+  if (threadAffinity != "empty" && threadAffinity != "none")
+    Parallel::pinThreads(threadAffinity);
+  Parallel::reportThreadPlacement();
+
+  // Create the solver
+  solver = _createSolver(*_transportProblem);
+  std::vector<double> v;
+  v = _input.getVector(path, "quadratureContinuation");
+  _quadratureContinuation = (v.size() > 0 && v[0] != 0);
+
+  std::string initialGuess = _input.getString(path, "initialGuess");
+  _diffusionInitialGuess = (initialGuess == "diffusion");
+  if (initialGuess != "empty" && initialGuess != "diffusion")
+    LOG_ERR("Invalid initial guess type: ", initialGuess);
+
+  v = _input.getVector(path, "reportWarmStartSavings");
+  _reportWarmStartSavings = (v.size() > 0 && v[0] != 0);
+}
+
+/**
+ *  Create a solver for the given transport problem from the Solver input.  The
+ *  solver type from the input can be overridden, e.g., for low-order solves.
+ */
+SolverBase*
+SolutionManager::_createSolver(TransportProblem& problem, std::string solverType)
+{
+  SolverBase* newSolver = NULL;
+
   // Parse solver input
   std::vector<std::string> path(1,"Solver");
-  std::string solverType = _input.getString(path, "type");
+  if (solverType == "")
+    solverType = _input.getString(path, "type");
   LOG("Solver type = " + solverType);
 
   // Set solver pointer
   if (solverType == "localMOC")
-    solver = new SolverLocalMOC(*_transportProblem);
+    newSolver = new SolverLocalMOC(problem);
   else if (solverType == "regMOC")
-    solver = new SolverRegMOC(*_transportProblem);
+    newSolver = new SolverRegMOC(problem);
+  else if (solverType == "diffusion")
+    newSolver = new SolverDiffusion(problem);
   else
     LOG_ERR("Invalid solver type");
   
   std::vector<double> v;
   v = _input.getVector(path, "rInfTolerance");
   if (v.size() > 0)
-    solver->setRInfTol( v[0] );
+    newSolver->setRInfTol( v[0] );
 
   v = _input.getVector(path, "maxIters");
   if (v.size() > 0)
-    solver->setMaxIters( v[0] );
-  
+    newSolver->setMaxIters( v[0] );
+
+  std::string convergenceNorm = _input.getString(path, "convergenceNorm");
+  if (convergenceNorm == "angular")
+    newSolver->setAngularConvergence(true);
+  else if (convergenceNorm != "empty" && convergenceNorm != "scalarFlux")
+    LOG_ERR("Invalid convergence norm: ", convergenceNorm);
+
+  v = _input.getVector(path, "freezeConvergedGroups");
+  if (v.size() > 0)
+    newSolver->setFreezeConvergedGroups( v[0] != 0 );
+
+  std::string sweepOrder = _input.getString(path, "sweepOrder");
+  if (sweepOrder == "reflective")
+    newSolver->setReflectiveSweepOrder(true);
+  else if (sweepOrder != "empty" && sweepOrder != "default")
+    LOG_ERR("Invalid sweep order: ", sweepOrder);
+
+  v = _input.getVector(path, "cacheSweepGeometry");
+  if (v.size() > 0)
+    newSolver->setCacheSweepGeometry( v[0] != 0 );
+
+  std::string decomposition = _input.getString(path, "decomposition");
+  if (decomposition == "angular")
+    newSolver->setAngularDecomposition(true);
+  else if (decomposition != "empty" && decomposition != "spatial")
+    LOG_ERR("Invalid decomposition: ", decomposition);
+
+  std::string threading = _input.getString(path, "threading");
+  if (threading == "subdomain")
+    newSolver->setThreadSubdomains(true);
+  else if (threading == "auto")
+    newSolver->setAutoThreading(true);
+  else if (threading != "empty" && threading != "angular")
+    LOG_ERR("Invalid threading: ", threading);
+
+  // Angular fluxes kept in file backed memory, swept in blocks of directions
+  std::string outOfCore = _input.getString(path, "outOfCore");
+  if (outOfCore != "empty")
+    newSolver->setOutOfCore(outOfCore);
+
+  v = _input.getVector(path, "angleBlockSize");
+  if (v.size() > 0)
+    newSolver->setAngleBlockSize( v[0] );
+
+  // Transients read the angular flux of every group and edge between steps
+  v = _input.getVector(path, "storedGroups");
+  if (v.size() > 0 && problemType == Transient)
+    LOG_ERR("A transient needs the angular fluxes of all groups; ignoring storedGroups.");
+  else if (v.size() > 0)
+    newSolver->setStoredGroups( v[0] );
+
+  std::string edgeStorage = _input.getString(path, "edgeStorage");
+  if (edgeStorage == "front" && problemType == Transient)
+    LOG_ERR("A transient needs the angular fluxes of all edges; ignoring the front edge storage.");
+  else if (edgeStorage == "front")
+    newSolver->setSweepFrontStorage(true);
+  else if (edgeStorage != "empty" && edgeStorage != "full")
+    LOG_ERR("Invalid edge storage: ", edgeStorage);
+
+  std::string partitioner = _input.getString(path, "partitioner");
+  if (partitioner == "rcb")
+    newSolver->setRefinePartition(false);
+  else if (partitioner != "empty" && partitioner != "graph")
+    LOG_ERR("Invalid partitioner: ", partitioner);
+
+  // Inner iteration tolerance policy
+  std::string innerTolerance = _input.getString(path, "innerTolerance");
+  if (innerTolerance == "adaptive")
+    newSolver->setAdaptiveInnerTol(true);
+  else if (innerTolerance != "empty" && innerTolerance != "fixed")
+    LOG_ERR("Invalid inner tolerance type: ", innerTolerance);
+
+  v = _input.getVector(path, "maxInnerTolerance");
+  if (v.size() > 0)
+    newSolver->setMaxInnerTol( v[0] );
+
+  // Fission source (outer) iteration parameters
+  v = _input.getVector(path, "fissionTolerance");
+  if (v.size() > 0)
+    newSolver->setFissionTol( v[0] );
+
+  v = _input.getVector(path, "wielandtShift");
+  if (v.size() > 0)
+    newSolver->setWielandtShift( v[0] );
+
+  std::string extrapolation = _input.getString(path, "fissionExtrapolation");
+  if (extrapolation == "chebyshev")
+    newSolver->setChebyshevExtrapolation(true);
+  else if (extrapolation != "empty" && extrapolation != "none")
+    LOG_ERR("Invalid fission extrapolation type: ", extrapolation);
+
+  newSolver->setupDecomposition();
+  return newSolver;
+}
+
+/**
+ *  Copy the source configuration and problem mode of the main solver
+ */
+void
+SolutionManager::_copySolverConfiguration(SolverBase* target)
+{
+  target->sourceConfig = solver->sourceConfig;
+  target->eigenvalueMode = solver->eigenvalueMode;
+  target->criticalEigenvalue = solver->criticalEigenvalue;
+  target->sourceScaling = solver->sourceScaling;
+}
+
+/// Solve with the requested warm start
+/**
+ *  With a diffusion initial guess, a diffusion solve of the same problem seeds
+ *  the scalar flux (and eigenvalue).  With quadrature continuation, the problem
+ *  is then converged with coarse product quadratures (S2, S4, ...) that have
+ *  fewer directions than the input quadrature.  Each solution seeds the next,
+ *  finer, solve and the last one seeds the main solver.  If requested, a
+ *  cold-started solve of the same problem is run first to report the number of
+ *  sweeps saved.
+ */
+void
+SolutionManager::_solveWithWarmStart()
+{
+  bool continuation = _quadratureContinuation && _transportProblem->quadOrder > 0;
+  bool diffusionGuess = _diffusionInitialGuess && _transportProblem->quadOrder > 0;
+  if (!continuation && !diffusionGuess) {
+    solver->solve();
+    return;
+  }
+
+  int targetOrder = _transportProblem->quadOrder;
+
+  long coldSweeps = 0;
+  if (_reportWarmStartSavings) {
+    SolverBase* coldSolver = _createSolver(*_transportProblem);
+    _copySolverConfiguration(coldSolver);
+    coldSolver->solve();
+    coldSweeps = coldSolver->getNumSweeps();
+    delete coldSolver;
+  }
+
+  SolverBase* coarseSolver = NULL;
+  TransportProblem* coarseProblem = NULL;
+  if (diffusionGuess) {
+    LOG("Calculating diffusion initial guess.");
+    coarseSolver = _createSolver(*_transportProblem, "diffusion");
+    _copySolverConfiguration(coarseSolver);
+    coarseSolver->solve();
+  }
+
+  double coarseSweepCost = 0.0;
+  for (int polarOrder=2; continuation; polarOrder*=2) {
+    TransportProblem* problem = new TransportProblem(*_transportProblem, polarOrder);
+    if (problem->quadOrder >= targetOrder) {
+      delete problem;
+      break;
+    }
+    LOG("Quadrature continuation: solving with ", problem->quadOrder, " directions.");
+
+    SolverBase* newSolver = _createSolver(*problem);
+    _copySolverConfiguration(newSolver);
+    if (coarseSolver) {
+      newSolver->seedScalarFlux(*coarseSolver);
+      newSolver->criticalEigenvalue = coarseSolver->criticalEigenvalue;
+      delete coarseSolver;
+      if (coarseProblem) delete coarseProblem;
+    }
+    newSolver->solve();
+    coarseSweepCost += double(newSolver->getNumSweeps())*problem->quadOrder/targetOrder;
+
+    coarseSolver = newSolver;
+    coarseProblem = problem;
+  }
+
+  if (coarseSolver) {
+    solver->seedScalarFlux(*coarseSolver);
+    solver->criticalEigenvalue = coarseSolver->criticalEigenvalue;
+    delete coarseSolver;
+    if (coarseProblem) delete coarseProblem;
+  }
+
+  long sweepsBefore = solver->getNumSweeps();
+  solver->solve();
+  long targetSweeps = solver->getNumSweeps() - sweepsBefore;
+
+  if (continuation)
+    LOG("Quadrature continuation: ", targetSweeps, " sweeps at the target order plus coarse sweeps costing ",
+        coarseSweepCost, " target-order sweeps.");
+  if (_reportWarmStartSavings)
+    LOG("Warm start saved ", coldSweeps - targetSweeps,
+        " target-order sweeps (", coldSweeps, " with a cold start, ", targetSweeps, " with a warm start).");
 }
 
 SolutionManager::~SolutionManager()
@@ -61,8 +294,17 @@ SolutionManager::~SolutionManager()
   meshFactory.deleteAllMesh();
 }
 
+/**
+ *  Write the eigenvalue and angular flux solution to an HDF5 file that can
+ *  be used as the initial condition of a transient.
+ */
 void
 SolutionManager::_dumpBaseSolution(std::string fileName)
 {
-  Output* stateFile = new Output("state", Output::HDF5);
+  Output* stateFile = new Output(fileName, Output::HDF5);
+  stateFile->writeData("k", &solver->criticalEigenvalue, 1);
+  double* solution = solver->copySolution(NULL);
+  stateFile->writeData("solution", solution, solver->getNumDOFs());
+  delete [] solution;
+  delete stateFile;
 }
@@ -1,16 +1,35 @@
 #include<cmath>
 #include<iostream>
 #include<iomanip>
+#include<algorithm>
 
 #include "solverbase.h"
+#include "material.h"
 #include "perfstats.h"
 #include "global.h"
+#include "associatedlegendre.h"
+#include "mathematics.h"
+
+// Number of unaccelerated outer iterations before the Wielandt shift and
+// Chebyshev extrapolation are switched on
+static const int numFreeFissionIters = 3;
 
 /**
  *  Define number of DOF, map DOFs, allocate solution vectors
  */
 SolverBase::SolverBase(TransportProblem &tp) :
-  _prob(tp), sourceScaling(1), criticalEigenvalue(1), _convRInfTol(1.0e-6), _maxIters(1000)
+  _prob(tp), sourceScaling(1), criticalEigenvalue(1), eigenvalueMode(false),
+  _cellFlux(NULL), _numSubCells(1), _numSweeps(0), _convRInfTol(1.0e-6), _maxIters(1000),
+  _adaptiveInnerTol(false), _innerTol(1.0e-6), _innerTolMax(1.0e-2), _inexactTol(0.0),
+  _forcingTerm(0.9), _prevOuterResidual(0.0),
+  _fissionDensity(NULL), _fissionDensityOuter(NULL), _fissionDensityOuterPrev(NULL),
+  _convFissionTol(1.0e-6), _wielandtShift(0.0), _lambda(1.0), _lambdaShift(0.0),
+  _prevFissionProduction(0.0), _useChebyshev(false), _chebyshevIter(0),
+  _dominanceRatio(0.0), _prevFissionResidual(0.0), _freezeConvergedGroups(true),
+  _angularConvergence(false), _scalarFlux(NULL), _scalarFluxPrev(NULL), _solutionStorage(NULL), _reflectFromPrev(false),
+  _numMoments(1), _reducedFluxMomentsValid(false), _reflectiveSweepOrder(false), _cacheSweepGeometry(false), _angularDecomposition(false), _refinePartition(true), _threadSubdomains(false),
+  _autoThreading(false), _angleBlockSize(0), _sweepFrontStorage(false), _firstStoredGroup(0), _numStoredGroups(tp.numGroups),
+  _reducedScalarFlux(NULL), _reducedScalarFluxValid(false), _zeroBoundaryFlux(0.0)
 {
 }
 
@@ -19,6 +38,12 @@ SolverBase::SolverBase(TransportProblem &tp) :
  */
 SolverBase::~SolverBase()
 {
+  if (_fissionDensity) delete [] _fissionDensity;
+  if (_fissionDensityOuter) delete [] _fissionDensityOuter;
+  if (_fissionDensityOuterPrev) delete [] _fissionDensityOuterPrev;
+  if (_scalarFlux) delete [] _scalarFlux;
+  if (_scalarFluxPrev) delete [] _scalarFluxPrev;
+  if (_reducedScalarFlux) delete [] _reducedScalarFlux;
 }
 
 /**
@@ -85,18 +110,12 @@ SolverBase::calculateLInfSolutionNorm(double* solutionComp)
 double
 SolverBase::calculateRInfSolutionNorm(double* solutionComp)
 {
-  long _dof_i = 0;
   double maxDiff = 0.0;
 
-  for (int g=0; g<_prob.numGroups; g++) {
-    for (long i=0; i<_prob.numCells; i++) {
-      for (int n=0; n<_prob.quadOrder; n++) {
-        if (_solution[_dof_i] > 0.0) {
-          maxDiff = fmax(maxDiff, std::abs((_solution[_dof_i] - solutionComp[_dof_i])/_solution[_dof_i]));
-        }
-	_dof_i++;
-      }
-    }
+  #pragma omp parallel for reduction(max:maxDiff)
+  for (long i=0; i<_numDOF; i++) {
+    if (_solution[i] > 0.0)
+      maxDiff = fmax(maxDiff, std::abs((_solution[i] - solutionComp[i])/_solution[i]));
   }
 
   return maxDiff;
@@ -152,11 +171,821 @@ SolverBase::calculateRInfSolutionError()
 void
 SolverBase::_saveOldSolution()
 {
+  #pragma omp parallel for
   for (long i=0; i<_numDOF; i++) {
     _solutionPrev[i] = _solution[i];
   }
 }
 
+/**
+ *  Keep the flux needed by the inner convergence test before a sweep.  The
+ *  sweep overwrites every edge flux of the active groups, so the old values
+ *  only need to be moved aside: the scalar flux buffers are swapped or, with
+ *  the angular norm, the solution buffers.  After a solution swap reflecting
+ *  boundaries read the last sweep's fluxes from _solutionPrev, and the fluxes
+ *  of frozen groups, which are not swept, are copied across.
+ */
+void
+SolverBase::_saveOldFlux()
+{
+  if (!_angularConvergence) {
+    std::swap(_scalarFlux, _scalarFluxPrev);
+    return;
+  }
+
+  // With a decomposition only the owned edges (or directions) are swept, and
+  // subdomain sweeps read the previous iterate on edges between subdomains.
+  // Reflection sets read fluxes swept earlier in the same sweep from _solution.
+  if (_spatialDecomposition() || _angularDecomposition || _threadSubdomains
+      || _reflectionSets.size() > 0) {
+    _saveOldSolution();
+    _reflectFromPrev = false;
+    return;
+  }
+
+  if (!_solutionStorage)
+    _solutionStorage = _solution;
+  std::swap(_solution, _solutionPrev);
+  _reflectFromPrev = true;
+
+  int G = _prob.numGroups;
+  bool anyFrozen = false;
+  for (int g=0; g<G; g++)
+    anyFrozen = anyFrozen || !_groupActive[g];
+  if (!anyFrozen)
+    return;
+
+  #pragma omp parallel for
+  for (long i=0; i<_numDOF; i++)
+    if (!_groupActive[(i/2) % G])
+      _solution[i] = _solutionPrev[i];
+}
+
+/**
+ *  Make _solution point to its original buffer again (DOF map pointers refer
+ *  to it).  Called at the end of a solve.
+ */
+void
+SolverBase::_restoreSolutionStorage()
+{
+  _reflectFromPrev = false;
+  if (!_solutionStorage || _solution == _solutionStorage)
+    return;
+
+  #pragma omp parallel for
+  for (long i=0; i<_numDOF; i++)
+    _solutionStorage[i] = _solution[i];
+  std::swap(_solution, _solutionPrev);
+}
+
+/**
+ *  Scale the edge and cell angular fluxes by a constant factor
+ */
+void
+SolverBase::_scaleSolution(double factor)
+{
+  for (long i=0; i<_numDOF; i++) {
+    _solution[i] = _solution[i] * factor;
+  }
+  for (long i=0; i<_numPhaseSpaceDOF; i++) {
+    _cellFlux[i] = _cellFlux[i] * factor;
+  }
+  if (_reducedScalarFluxValid) {
+    long size = _prob.numCells*_prob.numGroups*_numSubCells;
+    for (long i=0; i<size; i++)
+      _reducedScalarFlux[i] *= factor;
+  }
+}
+
+/**
+ *  Set the accuracy required by an enclosing iteration, e.g., the local
+ *  truncation error of a time step.  Ignored unless adaptive inner
+ *  tolerances are enabled.  It only loosens the inner tolerance, never
+ *  beyond the loosest inner tolerance allowed, and never the fission source
+ *  convergence test.
+ */
+void
+SolverBase::setInexactTol(double tol)
+{
+  if (_adaptiveInnerTol)
+    _inexactTol = fmin(fmax(tol, 0.0), _innerTolMax);
+}
+
+/**
+ *  Keep the angular fluxes of only numGroups groups at a time (0 or the
+ *  number of groups keeps all of them)
+ */
+void
+SolverBase::setStoredGroups(int numGroups)
+{
+  if (numGroups > 0 && numGroups < _prob.numGroups)
+    _numStoredGroups = numGroups;
+  else
+    _numStoredGroups = _prob.numGroups;
+}
+
+/// Set the inner tolerance for the first outer iteration
+/**
+ *  Without a fission source there is only a single outer iteration, so the
+ *  inner iterations must be converged to the final tolerance right away.
+ */
+void
+SolverBase::_initializeInnerTolerance()
+{
+  double finalTol = fmax(_convRInfTol, _inexactTol);
+  if (_adaptiveInnerTol && sourceConfig.hasFissionSource)
+    _innerTol = fmax(finalTol, _innerTolMax);
+  else
+    _innerTol = finalTol;
+  _forcingTerm = 0.9;
+  _prevOuterResidual = 0.0;
+}
+
+/// Update the inner tolerance from the outer residual
+/**
+ *  Eisenstat-Walker (choice 2) forcing term,
+ *
+ *    eta_k = gamma (r_k/r_{k-1})^2,  safeguarded by gamma eta_{k-1}^2,
+ *
+ *  so the inner tolerance, eta_k r_k, is loose while the outer iteration is far
+ *  from converged and tightens as it converges.
+ */
+void
+SolverBase::_updateInnerTolerance(double outerResidual)
+{
+  const double gamma = 0.9;
+  double finalTol = fmax(_convRInfTol, _inexactTol);
+
+  if (!_adaptiveInnerTol) {
+    _innerTol = finalTol;
+    return;
+  }
+
+  double eta = 0.9;
+  if (_prevOuterResidual > 0.0) {
+    eta = gamma*pow(outerResidual/_prevOuterResidual, 2);
+    double safeguard = gamma*pow(_forcingTerm, 2);
+    if (safeguard > 0.1)
+      eta = fmax(eta, safeguard);
+    eta = fmin(eta, 0.9);
+  }
+  _forcingTerm = eta;
+  _prevOuterResidual = outerResidual;
+
+  _innerTol = fmax(finalTol, fmin(_innerTolMax, eta*outerResidual));
+}
+
+/// Prepare the fission source (outer) iterations
+/**
+ *  The outer iteration solves
+ *
+ *    (L - S - lambda_s F) psi^(l+1) = (lambda - lambda_s) F psi^(l)
+ *
+ *  where lambda = 1/k in eigenvalue mode and unity otherwise, and lambda_s is
+ *  the Wielandt shift that is kept inside of the inner iterations.  The lagged
+ *  fission density is initialized from the current flux.
+ */
+void
+SolverBase::_initializeFissionIteration()
+{
+  long size = _prob.numCells*_numSubCells;
+  if (!_fissionDensity) {
+    _fissionDensity          = new double [size];
+    _fissionDensityOuter     = new double [size];
+    _fissionDensityOuterPrev = new double [size];
+  }
+
+  _calculateFissionDensity(_fissionDensityOuter);
+  for (long i=0; i<size; i++) {
+    _fissionDensity[i] = _fissionDensityOuter[i];
+    _fissionDensityOuterPrev[i] = _fissionDensityOuter[i];
+  }
+  _prevFissionProduction = _calculateFissionProduction(_fissionDensityOuter);
+
+  if (eigenvalueMode) {
+    if (_prevFissionProduction <= 0.0)
+      LOG_ERR("Eigenvalue calculation requested without a fission source.");
+    _lambda = 1.0/criticalEigenvalue;
+    _lambdaShift = 0.0;
+  }
+  else {
+    // Subcritical multiplication: shift relative to unit multiplication
+    _lambda = 1.0;
+    _lambdaShift = (_wielandtShift > 0.0) ? 1.0/(1.0 + _wielandtShift) : 0.0;
+  }
+
+  _chebyshevIter = -numFreeFissionIters;
+  _dominanceRatio = 0.0;
+  _prevFissionResidual = 0.0;
+}
+
+/**
+ *  Calculate the (sub-)cell fission neutron production density, summed over groups
+ */
+void
+SolverBase::_calculateFissionDensity(double* density)
+{
+  PerfStats X("SolverBase::_calculateFissionDensity");
+
+  #pragma omp parallel for
+  for (long i=0; i<_prob.numCells; i++) {
+    Material* mat = _prob.mesh->getElementMat(i);
+    for (int subCell=0; subCell<_numSubCells; subCell++) {
+      double production = 0.0;
+      for (int g=0; g<_prob.numGroups; g++) {
+        production += *mat->getNuSigma_f(g+1) * mat->_nu_sigma_f_scaling[g]
+                      * getSubCellScalarFlux(i, g, subCell);
+      }
+      density[_numSubCells*i + subCell] = production*4.0*pi;
+    }
+  }
+}
+
+/**
+ *  Integrate a fission density over the mesh (sub-cells have equal volumes)
+ */
+double
+SolverBase::_calculateFissionProduction(double* density)
+{
+  double totalProduction = 0.0;
+  for (long i=0; i<_prob.numCells; i++) {
+    if (!_ownsCell(i)) continue;
+    double subCellVolume = _prob.mesh->getElementVolume(i)/_numSubCells;
+    for (int subCell=0; subCell<_numSubCells; subCell++) {
+      totalProduction += density[_numSubCells*i + subCell]*subCellVolume;
+    }
+  }
+  if (_spatialDecomposition())
+    totalProduction = Parallel::sumAll(totalProduction);
+  return totalProduction;
+}
+
+/**
+ *  Angular fission source for one (sub-)cell and group
+ */
+double
+SolverBase::_getFissionSource(long space_i, int group_g, int subCell)
+{
+  long index = _numSubCells*space_i + subCell;
+  double chi = *_prob.mesh->getElementMat(space_i)->getFissionSpectrum(group_g+1);
+  return chi * ( _lambdaShift*_fissionDensity[index]
+                 + (_lambda - _lambdaShift)*_fissionDensityOuter[index] ) / (4.0*pi);
+}
+
+/// Update the lagged fission source at the end of an outer iteration
+/**
+ *  Updates the eigenvalue (if requested), tests for convergence, and forms the
+ *  next lagged fission density.  When Chebyshev extrapolation is enabled, the
+ *  dominance ratio is estimated from a few unaccelerated iterations and the
+ *  density is extrapolated using
+ *
+ *    x^(p+1) = x^(p) + alpha_p (y - x^(p)) + beta_p (x^(p) - x^(p-1))
+ *
+ *  The cycle is restarted whenever the residual grows.
+ *
+ *  Returns true when the outer iterations have converged.
+ */
+bool
+SolverBase::_updateFissionIteration(int fissionIter)
+{
+  PerfStats X("SolverBase::_updateFissionIteration");
+  long size = _prob.numCells*_numSubCells;
+
+  _calculateFissionDensity(_fissionDensity);
+  double production = _calculateFissionProduction(_fissionDensity);
+
+  // Without any fissile material there is nothing to iterate on, other than
+  // finishing a loosely converged inner iteration
+  if (production <= 0.0 || _prevFissionProduction <= 0.0) {
+    if (_innerTol <= fmax(_convRInfTol, _inexactTol))
+      return true;
+    _innerTol = fmax(_convRInfTol, _inexactTol);
+    return false;
+  }
+
+  double kPrev = criticalEigenvalue;
+  if (eigenvalueMode) {
+    _lambda = _lambdaShift + (_lambda - _lambdaShift)*_prevFissionProduction/production;
+    criticalEigenvalue = 1.0/_lambda;
+
+    // Renormalize the new iterate to the production of the lagged source
+    double factor = _prevFissionProduction/production;
+    _scaleSolution(factor);
+    for (long i=0; i<size; i++)
+      _fissionDensity[i] *= factor;
+  }
+
+  // Residual and convergence of the fission density
+  double residual = 0.0;
+  double maxDiff = 0.0;
+  for (long i=0; i<size; i++) {
+    if (!_ownsCell(i/_numSubCells)) continue;
+    double diff = _fissionDensity[i] - _fissionDensityOuter[i];
+    residual += diff*diff;
+    if (_fissionDensity[i] > 0.0)
+      maxDiff = fmax(maxDiff, std::abs(diff/_fissionDensity[i]));
+  }
+  if (_spatialDecomposition()) {
+    residual = Parallel::sumAll(residual);
+    maxDiff = Parallel::maxAll(maxDiff);
+  }
+  residual = sqrt(residual);
+
+  double fissionTol = _convFissionTol;
+  bool converged = (maxDiff < fissionTol);
+  if (eigenvalueMode) {
+    LOG("k = ", criticalEigenvalue);
+    converged = converged && (std::abs(criticalEigenvalue - kPrev)/criticalEigenvalue < fissionTol);
+  }
+  printIterStatus("fission", fissionIter, maxDiff, fissionTol);
+
+  // Only accept convergence once the inner iterations were fully converged
+  double innerTol = _innerTol;
+  _updateInnerTolerance(maxDiff);
+  if (converged && innerTol <= fmax(_convRInfTol, _inexactTol))
+    return true;
+  if (converged)
+    _innerTol = fmax(_convRInfTol, _inexactTol);
+
+  // Extrapolation parameters
+  double alpha = 1.0;
+  double beta = 0.0;
+  if (_useChebyshev) {
+    if (_chebyshevIter > 0 && residual > _prevFissionResidual) {
+      // Error growth: restart with unaccelerated iterations
+      LOG_DBG("Restarting Chebyshev extrapolation at outer iteration ", fissionIter);
+      _chebyshevIter = -2;
+    }
+    else if (_chebyshevIter < 0) {
+      _chebyshevIter++;
+    }
+    else if (_chebyshevIter == 0) {
+      if (_prevFissionResidual > 0.0)
+        _dominanceRatio = fmin(residual/_prevFissionResidual, 0.99);
+      if (_dominanceRatio > 0.0) {
+        alpha = 2.0/(2.0 - _dominanceRatio);
+        _chebyshevIter = 1;
+        LOG_DBG("Estimated dominance ratio = ", _dominanceRatio);
+      }
+    }
+    else {
+      _chebyshevIter++;
+      int p = _chebyshevIter;
+      double gamma = acosh(2.0/_dominanceRatio - 1.0);
+      alpha = 4.0/_dominanceRatio * cosh((p-1)*gamma)/cosh(p*gamma);
+      beta = (1.0 - _dominanceRatio/2.0)*alpha - 1.0;
+    }
+  }
+  _prevFissionResidual = residual;
+
+  // Form the next lagged fission density
+  for (long i=0; i<size; i++) {
+    double x = _fissionDensityOuter[i];
+    double xNew = x + alpha*(_fissionDensity[i] - x) + beta*(x - _fissionDensityOuterPrev[i]);
+    _fissionDensityOuterPrev[i] = x;
+    _fissionDensityOuter[i] = fmax(xNew, 0.0);
+    _fissionDensity[i] = _fissionDensityOuter[i];
+  }
+  _prevFissionProduction = _calculateFissionProduction(_fissionDensityOuter);
+
+  // Turn on the Wielandt shift once the eigenvalue estimate has settled
+  if (eigenvalueMode && _wielandtShift > 0.0 && fissionIter+1 >= numFreeFissionIters)
+    _lambdaShift = 1.0/(criticalEigenvalue + _wielandtShift);
+
+  return false;
+}
+
+/// Reactivate all energy groups
+/**
+ *  Called whenever the source external to the inner iterations changes, e.g.,
+ *  at the start of each outer iteration.  The inter-group scattering coupling
+ *  is built from the material list the first time through.
+ */
+void
+SolverBase::_initializeGroupConvergence()
+{
+  int G = _prob.numGroups;
+  _groupActive.assign(G, true);
+  _groupRInfNorm.assign(G, 0.0);
+
+  if (!_angularConvergence) {
+    if (!_scalarFlux) {
+      long size = _prob.numCells*G*_numSubCells;
+      _scalarFlux = new double [size];
+      _scalarFluxPrev = new double [size];
+    }
+    _calculateCachedScalarFlux(false);
+  }
+  else {
+    // Entries that are not swept (e.g., frozen groups) must agree in both buffers
+    _saveOldSolution();
+  }
+
+  if (_groupCoupling.size() == 0) {
+    _groupCoupling.assign(G*G, false);
+    for (std::map<unsigned int, Material*>::iterator it=MaterialFactory::_materialID.begin();
+         it!=MaterialFactory::_materialID.end();
+         ++it) {
+      for (int gp=0; gp<G; gp++) {
+        for (int g=0; g<G; g++) {
+          if (g != gp && *it->second->getSigma_s(gp+1,g+1) != 0.0)
+            _groupCoupling[gp*G + g] = true;
+        }
+      }
+    }
+  }
+}
+
+/**
+ *  Update the cached sub-cell scalar flux from the cell angular fluxes
+ */
+void
+SolverBase::_calculateCachedScalarFlux(bool activeGroupsOnly)
+{
+  int G = _prob.numGroups;
+
+  #pragma omp parallel for
+  for (long i=0; i<_prob.numCells; i++) {
+    for (int g=0; g<G; g++) {
+      if (activeGroupsOnly && !_groupActive[g]) continue;
+      for (int subCell=0; subCell<_numSubCells; subCell++)
+        _scalarFlux[(i*G + g)*_numSubCells + subCell] = getSubCellScalarFlux(i, g, subCell);
+    }
+  }
+}
+
+/// Per-group inner iteration convergence
+/**
+ *  Calculates the relative change of the sub-cell scalar fluxes (or, with the
+ *  angular norm, the edge fluxes) in each active group and freezes groups that
+ *  have converged.  A converged group is only frozen once
+ *  every group that scatters into it is frozen as well, so upscattering groups
+ *  converge together.  A Wielandt-shifted fission source couples all groups
+ *  inside the inner iterations, so no group is frozen in that case.
+ *
+ *  Edge DOFs are ordered (edge, angle, group, edge location) in all solvers.
+ *
+ *  Returns the maximum relative change over the groups swept this iteration.
+ */
+double
+SolverBase::_updateGroupConvergence()
+{
+  int G = _prob.numGroups;
+
+  for (int g=0; g<G; g++)
+    _groupRInfNorm[g] = 0.0;
+
+  if (_angularConvergence) {
+    for (long i=0; i<_numDOF; i++) {
+      int g = (i/2) % G;
+      if (_groupActive[g] && _solution[i] > 0.0)
+        _groupRInfNorm[g] = fmax(_groupRInfNorm[g], std::abs((_solution[i] - _solutionPrev[i])/_solution[i]));
+    }
+  }
+  else {
+    _calculateCachedScalarFlux(true);
+    for (int g=0; g<G; g++) {
+      if (!_groupActive[g]) continue;
+      double groupNorm = 0.0;
+      #pragma omp parallel for reduction(max:groupNorm)
+      for (long i=0; i<_prob.numCells; i++) {
+        for (int subCell=0; subCell<_numSubCells; subCell++) {
+          long index = (i*G + g)*_numSubCells + subCell;
+          if (_scalarFlux[index] > 0.0)
+            groupNorm = fmax(groupNorm, std::abs((_scalarFlux[index] - _scalarFluxPrev[index])/_scalarFlux[index]));
+        }
+      }
+      _groupRInfNorm[g] = groupNorm;
+    }
+  }
+  Parallel::maxAll(&_groupRInfNorm[0], G);
+
+  double maxDiff = 0.0;
+  for (int g=0; g<G; g++) {
+    if (_groupActive[g])
+      maxDiff = fmax(maxDiff, _groupRInfNorm[g]);
+  }
+
+  if (!_freezeConvergedGroups ||
+      (sourceConfig.hasFissionSource && _lambdaShift != 0.0))
+    return maxDiff;
+
+  // Candidates are converged (or already frozen) groups; drop any candidate that
+  // receives neutrons from a non-candidate until the set no longer changes.
+  std::vector<bool> frozen(G);
+  for (int g=0; g<G; g++)
+    frozen[g] = !_groupActive[g] || _groupRInfNorm[g] < _innerTol;
+
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int g=0; g<G; g++) {
+      if (!frozen[g]) continue;
+      for (int gp=0; gp<G; gp++) {
+        if (!frozen[gp] && _groupCoupling[gp*G + g]) {
+          frozen[g] = false;
+          changed = true;
+          break;
+        }
+      }
+    }
+  }
+
+  for (int g=0; g<G; g++) {
+    if (_groupActive[g] && frozen[g]) {
+      LOG_DBG("Group ", g+1, " converged; freezing.");
+      _groupActive[g] = false;
+    }
+  }
+
+  return maxDiff;
+}
+
+/// Build the discrete-to-moment and moment-to-discrete operators
+/**
+ *  Real spherical harmonics, normalized such that the sum over m of
+ *  Y_lm(a)Y_lm(b) is P_l(a.b), are evaluated at the quadrature directions
+ *  (polar axis z).  With Legendre scattering moments sigma_l, the scattering
+ *  source in direction n is
+ *    sum_k M[n][k] sigma_l(k) phi_k,   phi_k = sum_n' D[k][n'] psi_n',
+ *  where the zeroth moment is the angular average used for the scalar flux.
+ *
+ *  2D quadratures only keep directions with omega_z >= 0, as the flux is
+ *  symmetric about the xy-plane.  The harmonics with l+m odd are odd in z, so
+ *  their moments vanish over the sphere, but not over the half range the
+ *  quadrature covers; only the (L+1)(L+2)/2 moments with l+m even are built.
+ */
+void
+SolverBase::_buildMomentOperators()
+{
+  int L = _prob.scatterAnisotropy;
+  int Q = _prob.quadOrder;
+  bool halfRange = true;
+  for (int n=0; n<Q; n++)
+    halfRange = halfRange && (_prob.omega_z[n] >= 0.0);
+  _numMoments = halfRange ? (L+1)*(L+2)/2 : (L+1)*(L+1);
+  _momentDegree.resize(_numMoments);
+  _discreteToMoment.assign(_numMoments*Q, 0.0);
+  _momentToDiscrete.assign(Q*_numMoments, 0.0);
+
+  double sumOfWeights = 0.0;
+  for (int n=0; n<Q; n++)
+    sumOfWeights += _prob.weights[n];
+
+  math::AssociatedLegendrePolynomial P(L);
+  for (int n=0; n<Q; n++) {
+    double phi = atan2(_prob.omega_y[n], _prob.omega_x[n]);
+    P.evaluate(_prob.omega_z[n]);
+    int k = 0;
+    for (int ell=0; ell<=L; ell++) {
+      for (int m=-ell; m<=ell; m++) {
+        if (halfRange && (ell + m) % 2 != 0) continue;
+        int absM = std::abs(m);
+        double norm = sqrt((m == 0 ? 1.0 : 2.0)*math::factorial(ell-absM)/double(math::factorial(ell+absM)));
+        double Y = norm*P(ell,absM)*(m < 0 ? sin(absM*phi) : cos(m*phi));
+        _momentDegree[k] = ell;
+        _discreteToMoment[k*Q + n] = _prob.weights[n]*Y/sumOfWeights;
+        _momentToDiscrete[n*_numMoments + k] = (2*ell + 1)*Y;
+        k++;
+      }
+    }
+  }
+  LOG_DBG("Built ", _numMoments, " scattering moment operators.");
+}
+
+/**
+ *  Add the P_N scattering source.  For each (sub-)cell the flux moments of all
+ *  groups are formed from the cell angular fluxes, transferred between groups
+ *  with the Legendre moments of the scattering matrix, and expanded back onto
+ *  the directions.  Sources are stored at the cell flux indices.  With an
+ *  angular decomposition the moments were already summed over the ranks and
+ *  only the owned directions get a source.
+ */
+void
+SolverBase::_addAnisotropicScatterSource()
+{
+  if (_momentDegree.size() == 0)
+    _buildMomentOperators();
+
+  int G = _prob.numGroups;
+  int Q = _prob.quadOrder;
+  int M = _numMoments;
+
+  #pragma omp parallel
+  {
+    std::vector<double> fluxMoments(G*M);
+    std::vector<double> sourceMoments(M);
+
+    #pragma omp for
+    for (long i=0; i<_prob.numCells; i++) {
+      if (!_ownsCell(i)) continue;
+      Material* mat = _prob.mesh->getElementMat(i);
+      for (int subCell=0; subCell<_numSubCells; subCell++) {
+        for (int gp=0; gp<G; gp++) {
+          for (int k=0; k<M; k++) {
+            if (_reducedFluxMomentsValid) {
+              fluxMoments[gp*M + k] = _reducedFluxMoments[((i*_numSubCells + subCell)*G + gp)*M + k];
+              continue;
+            }
+            double moment = 0.0;
+            for (int n=0; n<Q; n++)
+              moment += _discreteToMoment[k*Q + n]*_cellFlux[_cellFluxIndex(i,n,gp,subCell)];
+            fluxMoments[gp*M + k] = moment;
+          }
+        }
+
+        for (int g=0; g<G; g++) {
+          if (!_groupActive[g]) continue;
+          for (int k=0; k<M; k++) {
+            sourceMoments[k] = 0.0;
+            if (_momentDegree[k] > mat->scatteringOrder) continue;
+            for (int gp=0; gp<G; gp++)
+              sourceMoments[k] += *mat->getSigma_s(gp+1,g+1,_momentDegree[k])*fluxMoments[gp*M + k];
+          }
+          for (int n=0; n<Q; n++) {
+            if (!_ownsDirection(n)) continue;
+            double src = 0.0;
+            for (int k=0; k<M; k++)
+              src += _momentToDiscrete[n*M + k]*sourceMoments[k];
+            _source[_cellFluxIndex(i,n,g,subCell)] += src;
+          }
+        }
+      }
+    }
+  }
+}
+
+/**
+ *  Record that direction np is the reflection of direction n at some boundary.
+ *  Only done while the reflection sets are being discovered.
+ */
+void
+SolverBase::_linkReflectedDirections(int n, int np)
+{
+  if (!_reflectiveSweepOrder || _reflectionSets.size() > 0 || np < 0)
+    return;
+
+  if (_reflectionParent.size() == 0) {
+    _reflectionParent.resize(_prob.quadOrder);
+    for (int i=0; i<_prob.quadOrder; i++)
+      _reflectionParent[i] = i;
+  }
+
+  int rootN = _findReflectionRoot(n);
+  int rootNp = _findReflectionRoot(np);
+  if (rootN != rootNp)
+    _reflectionParent[std::max(rootN, rootNp)] = std::min(rootN, rootNp);
+}
+
+int
+SolverBase::_findReflectionRoot(int n)
+{
+  while (_reflectionParent[n] != n)
+    n = _reflectionParent[n];
+  return n;
+}
+
+/// Group directions into reflection sets
+/**
+ *  Must be called after a full boundary condition pass has linked every
+ *  reflected direction.  Directions that never reflect form their own set.
+ *  If no direction reflects, the default (all directions in parallel) sweep
+ *  order is kept.
+ */
+void
+SolverBase::_buildReflectionSets()
+{
+  _reflectionSets.clear();
+  if (_reflectionParent.size() == 0) {
+    LOG_WARN("No reflecting boundaries found; using the default sweep order.");
+    _reflectiveSweepOrder = false;
+    return;
+  }
+
+  std::map<int, int> rootToSet;
+  for (int n=0; n<_prob.quadOrder; n++) {
+    int root = _findReflectionRoot(n);
+    std::map<int, int>::iterator it = rootToSet.find(root);
+    if (it == rootToSet.end()) {
+      rootToSet[root] = _reflectionSets.size();
+      _reflectionSets.push_back( std::vector<int>(1, n) );
+    }
+    else {
+      _reflectionSets[it->second].push_back(n);
+    }
+  }
+  LOG("Sweeping ", _prob.quadOrder, " directions in ", _reflectionSets.size(), " reflection sets.");
+}
+
+/**
+ *  Start a new boundary condition plan with an empty copy list per direction
+ */
+void
+SolverBase::_initializeBoundaryPlan()
+{
+  _bcPlan.clear();
+  _bcPlan.resize(_prob.quadOrder);
+}
+
+/**
+ *  Add a copy of value into the boundary flux bdryDOF for direction n.  The
+ *  boundary flux is created here so the sweeps only ever read existing entries.
+ *  Entries of groups that are not stored are skipped, so the plan only covers
+ *  the current group block.
+ */
+void
+SolverBase::_addBoundaryPlanEntry(int n, const DOFObj& bdryDOF, const double* value)
+{
+  if (!_storesGroup(bdryDOF.energyGroup))
+    return;
+
+  BoundaryPlanEntry entry;
+  entry.target = &_bdryFlux[bdryDOF];
+  entry.value = value;
+  entry.solutionIndex = -1;
+  _bcPlan[n].push_back(entry);
+}
+
+/**
+ *  Add a copy of solution DOF solutionIndex (a reflected flux) into the
+ *  boundary flux bdryDOF for direction n
+ */
+void
+SolverBase::_addBoundaryPlanEntry(int n, const DOFObj& bdryDOF, long solutionIndex)
+{
+  if (!_storesGroup(bdryDOF.energyGroup))
+    return;
+
+  BoundaryPlanEntry entry;
+  entry.target = &_bdryFlux[bdryDOF];
+  entry.value = NULL;
+  entry.solutionIndex = solutionIndex;
+  _bcPlan[n].push_back(entry);
+}
+
+/**
+ *  Add plan entries copying the boundary source read from file for edge into
+ *  the numEdgeLocs boundary fluxes starting at bdryID.  Returns false if the
+ *  file has no source for this edge.
+ */
+bool
+SolverBase::_addFileBoundarySource(int n, long edge, long bdryID, int numEdgeLocs)
+{
+  if (edge < 0 || !_prob.getBoundarySource(edge, n, 0))
+    return false;
+
+  for (int g=_firstStoredGroup; g<_endStoredGroup(); g++)
+    for (int loc=0; loc<numEdgeLocs; loc++)
+      _addBoundaryPlanEntry(n, DOFObj(bdryID+loc,n,g), _prob.getBoundarySource(edge,n,g));
+  return true;
+}
+
+/**
+ *  Apply the boundary condition plan for one direction, or for all directions
+ *  (in parallel) if angle is negative
+ */
+void
+SolverBase::_executeBoundaryPlan(int angle)
+{
+  const double* reflected = _reflectFromPrev ? _solutionPrev : _solution;
+
+  if (angle >= 0) {
+    std::vector<BoundaryPlanEntry>& plan = _bcPlan[angle];
+    for (long e=0; e<plan.size(); e++)
+      *plan[e].target = (plan[e].solutionIndex < 0) ? *plan[e].value : reflected[plan[e].solutionIndex];
+    return;
+  }
+
+  #pragma omp parallel for schedule(dynamic)
+  for (int n=0; n<_bcPlan.size(); n++) {
+    std::vector<BoundaryPlanEntry>& plan = _bcPlan[n];
+    for (long e=0; e<plan.size(); e++)
+      *plan[e].target = (plan[e].solutionIndex < 0) ? *plan[e].value : reflected[plan[e].solutionIndex];
+  }
+}
+
+/**
+ *  Entry of the reflected direction table for direction n at a boundary with
+ *  unit normal (nx,ny).  Boundaries typically have only a handful of distinct
+ *  normals, so each reflection only has to be searched for once.
+ */
+int&
+SolverBase::_reflectedDirection(double nx, double ny, int n)
+{
+  int normal;
+  for (normal=0; normal<_bcNormals.size()/2; normal++)
+    if (std::abs(nx-_bcNormals[2*normal]) < 1.0e-8 && std::abs(ny-_bcNormals[2*normal+1]) < 1.0e-8)
+      break;
+
+  if (normal == _bcNormals.size()/2) {
+    _bcNormals.push_back(nx);
+    _bcNormals.push_back(ny);
+    _bcReflectedDir.resize(_bcReflectedDir.size() + _prob.quadOrder, -2);
+  }
+
+  return _bcReflectedDir[normal*_prob.quadOrder + n];
+}
+
 double
 SolverBase::getNeutronProduction(long space_i)
 {
@@ -177,6 +1006,7 @@ SolverBase::getTotalNeutronProduction()
   double totalProductionRate = 0;
   double meshVolume;
   for (long i=0; i<_prob.numCells; i++) {
+    if (!_ownsCell(i)) continue;
     meshVolume = _prob.mesh->getElementVolume(i);
     for (int g=0; g<_prob.numGroups; g++) {
       totalProductionRate += *_prob.mesh->getElementMat(i)->getNuSigma_f(g+1)
@@ -184,10 +1014,28 @@ SolverBase::getTotalNeutronProduction()
                              * meshVolume;
     }
   }
+  if (_spatialDecomposition())
+    totalProductionRate = Parallel::sumAll(totalProductionRate);
   return totalProductionRate;
 }
 
 
+/**
+ *  The DOF map is not built out of core, nor for the cells and edges a rank
+ *  of a spatial decomposition does not keep.  Unmapped DOFs are located by
+ *  the method's index, and read as zero if they are not kept.
+ */
+const double*
+SolverBase::getSolutionValue(long space_i, int quad_n, int group_g)
+{
+  std::map<DOFObj, double*>::iterator it = DOFmap.find(DOFObj(space_i, quad_n, group_g));
+  if (it != DOFmap.end())
+    return it->second;
+
+  long index = _solutionIndex(space_i, quad_n, group_g);
+  return (index < 0) ? &_zeroBoundaryFlux : &_solution[index];
+}
+
 void
 SolverBase::setSolution(double* solution)
 {
@@ -214,9 +1062,7 @@ void
 SolverBase::normalizeSolution(double totalProductionRate)
 {
   double norm = totalProductionRate/getTotalNeutronProduction();
-  for (long i=0; i<_numDOF; i++) {
-    _solution[i] = _solution[i] * norm;
-  }  
+  _scaleSolution(norm);
 }
 
 
@@ -226,9 +1072,46 @@ SolverBase::zeroSolution()
   for (long i=0; i<_numDOF; i++) {
     _solution[i] = 0.0;
   }
+  if (_cellFlux)
+    for (long i=0; i<_numPhaseSpaceDOF; i++)
+      _cellFlux[i] = 0.0;
+  if (_groupBlockStorage() && _reducedScalarFlux)
+    for (long i=0; i<_prob.numCells*_prob.numGroups*_numSubCells; i++)
+      _reducedScalarFlux[i] = 0.0;
 }
 
 
+/**
+ *  Set the cell angular fluxes to the isotropic flux of another solution, e.g.,
+ *  one computed with a coarser angular quadrature or a low-order method.  This
+ *  seeds the scattering and fission sources of the first iteration.
+ */
+void
+SolverBase::seedScalarFlux(SolverBase& guess)
+{
+  PerfStats X("SolverBase::seedScalarFlux");
+
+  #pragma omp parallel for
+  for (long i=0; i<_prob.numCells; i++) {
+    if (!_ownsCell(i)) continue;
+    for (int g=0; g<_prob.numGroups; g++) {
+      for (int subCell=0; subCell<_numSubCells; subCell++) {
+        double scalarFlux;
+        if (guess._numSubCells == _numSubCells)
+          scalarFlux = guess.getSubCellScalarFlux(i, g, subCell);
+        else
+          scalarFlux = guess.getScalarFlux(i, g);
+        if (_groupBlockStorage()) {
+          _reducedScalarFlux[(i*_prob.numGroups + g)*_numSubCells + subCell] = scalarFlux;
+          continue;
+        }
+        for (int n=0; n<_prob.quadOrder; n++)
+          _cellFlux[_cellFluxIndex(i,n,g,subCell)] = scalarFlux;
+      }
+    }
+  }
+}
+
 void
 SolverBase::extrapolateSolution(double expExtrapFactor)
 {
@@ -249,13 +1132,15 @@ void
 SolverBase::writeSolution(Output* outputFile)
 {
   outputFile->writeData("numDOFs", &_numDOF, 1);
+  if (_spatialDecomposition())
+    outputFile->writeData("partition", &_prob.mesh->elementPartition[0], _prob.numCells);
   //outputFile->writeData("solution", _solution, _numDOF);
   //if (outputFile->outputFormat & Output::MESH)
   //  _prob.mesh->writeMesh(outputFile);
 }
 
 void
-SolverBase::writeScalarFlux(Output* outputFile)
+SolverBase::writeScalarFlux(Output* outputFile, std::string suffix)
 {
   // Should write this to a "Solver" group
   long outputSize = _numSpaceDOF;
@@ -271,7 +1156,7 @@ SolverBase::writeScalarFlux(Output* outputFile)
       outputBuffer[i] = getScalarFlux( i, g );
     }
     varNameStream.str("");
-    varNameStream << "scalarFlux_" << g+1;
+    varNameStream << "scalarFlux_" << g+1 << suffix;
     varName = varNameStream.str();
     //outputFile->writeData(varName, outputBuffer, outputSize);
     if (outputFile->outputFormat & Output::MESH) {
@@ -0,0 +1,348 @@
+#include "solverdiffusion.h"
+#include "material.h"
+#include "global.h"
+
+#include <cmath>
+
+SolverDiffusion::SolverDiffusion(TransportProblem &tp)
+  : SolverBase(tp)
+{
+  // Define number of DOFs
+  _numDOF = tp.numCells * tp.numGroups;
+  _numPhaseSpaceDOF = 0;
+  _numSpaceDOF = tp.numCells;
+  LOG_DBG("num dof = ",_numDOF);
+  LOG_DBG("num space dof = ", tp.numCells);
+
+  mesh = dynamic_cast<MoabMesh*>(_prob.mesh);
+  if (!mesh) {
+    LOG_ERR("This solver needs a MOAB mesh.");
+    return;
+  }
+
+  // Allocate and initialize solution and source arrays
+  _solution     = new double [_numDOF];
+  _residual     = new double [_numDOF];
+  _solutionPrev = new double [_numDOF];
+  _source       = new double [_numDOF];
+  for (long i=0; i<_numDOF; i++) {
+    _solution[i] = 1.0;
+    _solutionPrev[i] = 0.0;
+    _source[i] = 0.0;
+  }
+
+  long N = tp.numCells;
+  _diag = new double [N];
+  _rhs  = new double [N];
+  _r    = new double [N];
+  _z    = new double [N];
+  _p    = new double [N];
+  _q    = new double [N];
+  _x    = new double [N];
+
+  _mapDOFs();
+  _setupGeometry();
+}
+
+SolverDiffusion::~SolverDiffusion()
+{
+  delete [] _solution;
+  delete [] _residual;
+  delete [] _solutionPrev;
+  delete [] _source;
+  delete [] _diag;
+  delete [] _rhs;
+  delete [] _r;
+  delete [] _z;
+  delete [] _p;
+  delete [] _q;
+  delete [] _x;
+}
+
+/// Map degrees-of-freedom
+void
+SolverDiffusion::_mapDOFs()
+{
+}
+
+void
+SolverDiffusion::_calculateMatrixAction(double*, double*)
+{
+}
+
+/// Precompute the finite volume geometry
+/**
+ *  Edge v of an element joins vertices v and v+1.  The centroid-to-edge
+ *  distance is 2A/(3L).  Boundary edges store the incoming angular flux of
+ *  each group for vacuum (0) and source boundaries, or -1 for reflecting
+ *  boundaries.
+ */
+void
+SolverDiffusion::_setupGeometry()
+{
+  long N = _prob.numCells;
+  int G = _prob.numGroups;
+  int nxtNghbr[3] = {1, 2, 0};
+  _neighbor.resize(3*N);
+  _edgeLength.resize(3*N);
+  _edgeDistance.resize(3*N);
+  _boundarySource.assign(3*N*G, 0.0);
+  _volume.resize(N);
+
+  UltraLightElement element;
+  for (long i=0; i<N; i++) {
+    mesh->getCurrentElementFromID(i, element);
+    _volume[i] = mesh->getElementVolume(i);
+    double xc = (element.x[0] + element.x[1] + element.x[2])/3.0;
+    double yc = (element.y[0] + element.y[1] + element.y[2])/3.0;
+    for (int v=0; v<3; v++) {
+      int vn = nxtNghbr[v];
+      double dx = element.x[vn] - element.x[v];
+      double dy = element.y[vn] - element.y[v];
+      double L = sqrt(dx*dx + dy*dy);
+      _neighbor[3*i+v] = element.neighborID[v];
+      _edgeLength[3*i+v] = L;
+      _edgeDistance[3*i+v] = 2.0*_volume[i]/(3.0*L);
+
+      if (element.neighborID[v] >= 0) continue;
+
+      // Outward unit normal of the boundary edge
+      double nx = dy/L;
+      double ny = -dx/L;
+      if (nx*(element.x[v] + 0.5*dx - xc) + ny*(element.y[v] + 0.5*dy - yc) < 0.0) {
+        nx = -nx;
+        ny = -ny;
+      }
+
+      double* bdrySrc = &_boundarySource[(3*i+v)*G];
+      long edge = mesh->getEdgeID(i, element.neighborID[v]);
+      if (_prob.globalBC == reflecting) {
+        for (int g=0; g<G; g++)
+          bdrySrc[g] = -1.0;
+      }
+      else if (_prob.globalBC == source && edge >= 0 && _prob.getBoundarySource(edge, 0, 0)) {
+        for (int g=0; g<G; g++)
+          bdrySrc[g] = _getIsotropicBoundarySource(edge, g, nx, ny);
+      }
+      else if (_prob.globalBC == source) {
+        for (int bi=0; bi<_prob.nxnyq.size(); bi+=3) {
+          if (std::abs(nx-_prob.nxnyq[bi]) < 1.0e-8 && std::abs(ny-_prob.nxnyq[bi+1]) < 1.0e-8)
+            for (int g=0; g<G; g++)
+              bdrySrc[g] = (_prob.nxnyq[bi+2] < 0.0) ? -1.0 : _prob.nxnyq[bi+2];
+        }
+      }
+    }
+  }
+}
+
+/// Isotropic (angle-averaged) external source
+double
+SolverDiffusion::_getIsotropicExtSource(long i, int g)
+{
+  if (_prob.quadOrder == 0)
+    return *_prob.getExtSource(i,0,g);
+
+  double src = 0.0;
+  double sumOfWeights = 0.0;
+  for (int n=0; n<_prob.quadOrder; n++) {
+    src += _prob.weights[n] * *_prob.getExtSource(i,n,g);
+    sumOfWeights += _prob.weights[n];
+  }
+  return src/sumOfWeights;
+}
+
+/// Isotropic incoming angular flux of a boundary source read from file
+/**
+ *  The incoming directions are weighted by |Omega.n|, so the isotropic flux
+ *  carries the same incoming partial current into the Marshak condition.
+ *  (nx,ny) is the outward unit normal of the edge.
+ */
+double
+SolverDiffusion::_getIsotropicBoundarySource(long edge, int g, double nx, double ny)
+{
+  double current = 0.0;
+  double sumOfWeights = 0.0;
+  for (int n=0; n<_prob.quadOrder; n++) {
+    double OmegaDotN = _prob.omega_x[n]*nx + _prob.omega_y[n]*ny;
+    if (OmegaDotN >= 0.0) continue;
+    current -= _prob.weights[n] * OmegaDotN * *_prob.getBoundarySource(edge,n,g);
+    sumOfWeights -= _prob.weights[n] * OmegaDotN;
+  }
+  return (sumOfWeights > 0.0) ? current/sumOfWeights : 0.0;
+}
+
+/// Implementation of the diffusion solver
+/**
+ *  The outer (fission) iterations are shared with the transport solvers.  The
+ *  inner iterations are Gauss-Seidel over groups, with each within-group
+ *  problem solved by preconditioned conjugate gradients.
+ */
+void
+SolverDiffusion::solve()
+{
+  PerfStats X("SolverDiffusion::solve");
+
+  double convRInf = 1e10;
+  int scatterIter;
+  int fissionIter;
+
+  _initializeInnerTolerance();
+  if (sourceConfig.hasFissionSource)
+    _initializeFissionIteration();
+
+  for (fissionIter=0; fissionIter<_maxIters; fissionIter++) {
+    // Perform scattering iterations
+    for (scatterIter=0; scatterIter<_maxIters; scatterIter++) {
+      _saveOldSolution();
+      _calculateSource();
+      for (int g=0; g<_prob.numGroups; g++)
+        _solveGroup(g);
+      _numSweeps++;
+
+      // Test for convergence of inner iterations
+      convRInf = 0.0;
+      for (long i=0; i<_numDOF; i++) {
+        if (_solution[i] > 0.0)
+          convRInf = fmax(convRInf, std::abs((_solution[i] - _solutionPrev[i])/_solution[i]));
+      }
+      if (convRInf < _innerTol) break;
+    }
+    // Test for convergence of fission iterations
+    printIterStatus("scatter", scatterIter, convRInf, _innerTol);
+    if (!sourceConfig.hasFissionSource) break;
+    if (_updateFissionIteration(fissionIter)) break;
+  }
+}
+
+/**
+ *  External and fission sources (the scattering source is added per group)
+ */
+void
+SolverDiffusion::_calculateSource()
+{
+  PerfStats X("SolverDiffusion::_calculateSource");
+
+  if (sourceConfig.hasFissionSource && _lambdaShift != 0.0)
+    _calculateFissionDensity(_fissionDensity);
+
+  #pragma omp parallel for
+  for (long i=0; i<_prob.numCells; i++) {
+    for (int g=0; g<_prob.numGroups; g++) {
+      double src = 0.0;
+      if (sourceConfig.hasExternalSource)
+        src = _getIsotropicExtSource(i,g) * sourceScaling;
+      if (sourceConfig.hasFissionSource)
+        src += _getFissionSource(i, g, 0);
+      _source[_dofIndex(i,g)] = src;
+    }
+  }
+}
+
+/// Apply the within-group diffusion operator
+void
+SolverDiffusion::_applyOperator(int g, double* x, double* y)
+{
+  #pragma omp parallel for
+  for (long i=0; i<_prob.numCells; i++) {
+    double Di = 1.0/(3.0*fmax(*mesh->getElementMat(i)->getSigma_t(g+1), 1.0e-10));
+    double value = _diag[i]*x[i];
+    for (int v=0; v<3; v++) {
+      long j = _neighbor[3*i+v];
+      if (j < 0) continue;
+      double Dj = 1.0/(3.0*fmax(*mesh->getElementMat(j)->getSigma_t(g+1), 1.0e-10));
+      double coupling = _edgeLength[3*i+v]/(_edgeDistance[3*i+v]/Di + _edgeDistance[3*i+v]/Dj);
+      value -= coupling*x[j];
+    }
+    y[i] = value;
+  }
+}
+
+/// Solve the within-group diffusion problem
+void
+SolverDiffusion::_solveGroup(int g)
+{
+  long N = _prob.numCells;
+
+  // Diagonal and right hand side
+  #pragma omp parallel for
+  for (long i=0; i<N; i++) {
+    Material* mat = mesh->getElementMat(i);
+    double Di = 1.0/(3.0*fmax(*mat->getSigma_t(g+1), 1.0e-10));
+    double removal = *mat->getSigma_t(g+1) - *mat->getSigma_s(g+1,g+1);
+    double diag = removal*_volume[i];
+    double rhs = _source[_dofIndex(i,g)];
+    for (int gp=0; gp<_prob.numGroups; gp++) {
+      if (gp != g)
+        rhs += *mat->getSigma_s(gp+1,g+1) * _solution[_dofIndex(i,gp)];
+    }
+    rhs *= _volume[i];
+
+    for (int v=0; v<3; v++) {
+      long j = _neighbor[3*i+v];
+      double L = _edgeLength[3*i+v];
+      double h = _edgeDistance[3*i+v];
+      if (j >= 0) {
+        double Dj = 1.0/(3.0*fmax(*mesh->getElementMat(j)->getSigma_t(g+1), 1.0e-10));
+        diag += L/(h/Di + h/Dj);
+      }
+      else if (_boundarySource[(3*i+v)*_prob.numGroups + g] >= 0.0) {
+        // Marshak condition with an incoming isotropic angular flux
+        diag += L*Di/(2.0*Di + h);
+        rhs += L*Di*_boundarySource[(3*i+v)*_prob.numGroups + g]/(2.0*Di + h);
+      }
+    }
+    _diag[i] = diag;
+    _rhs[i] = rhs;
+    _x[i] = _solution[_dofIndex(i,g)];
+  }
+
+  // Jacobi preconditioned conjugate gradients
+  double rhsNorm = 0.0;
+  for (long i=0; i<N; i++)
+    rhsNorm += _rhs[i]*_rhs[i];
+  rhsNorm = sqrt(rhsNorm);
+  if (rhsNorm == 0.0) {
+    for (long i=0; i<N; i++)
+      _solution[_dofIndex(i,g)] = 0.0;
+    return;
+  }
+
+  _applyOperator(g, _x, _q);
+  double rz = 0.0;
+  for (long i=0; i<N; i++) {
+    _r[i] = _rhs[i] - _q[i];
+    _z[i] = _r[i]/_diag[i];
+    _p[i] = _z[i];
+    rz += _r[i]*_z[i];
+  }
+
+  double tol = 0.1*_innerTol*rhsNorm;
+  int maxIters = (N > 100) ? N : 100;
+  for (int iter=0; iter<maxIters; iter++) {
+    double rNorm = 0.0;
+    for (long i=0; i<N; i++)
+      rNorm += _r[i]*_r[i];
+    if (sqrt(rNorm) < tol) break;
+
+    _applyOperator(g, _p, _q);
+    double pq = 0.0;
+    for (long i=0; i<N; i++)
+      pq += _p[i]*_q[i];
+    double alpha = rz/pq;
+
+    double rzNew = 0.0;
+    for (long i=0; i<N; i++) {
+      _x[i] += alpha*_p[i];
+      _r[i] -= alpha*_q[i];
+      _z[i] = _r[i]/_diag[i];
+      rzNew += _r[i]*_z[i];
+    }
+    double beta = rzNew/rz;
+    rz = rzNew;
+    for (long i=0; i<N; i++)
+      _p[i] = _z[i] + beta*_p[i];
+  }
+
+  for (long i=0; i<N; i++)
+    _solution[_dofIndex(i,g)] = _x[i];
+}
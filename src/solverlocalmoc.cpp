@@ -1,300 +1,201 @@
 #include "solverlocalmoc.h"
 #include "global.h"
-#include "sweeper.h"
 
 #include <iomanip>
 
 SolverLocalMOC::SolverLocalMOC(TransportProblem &tp)
-  : SolverBase(tp)
+  : SolverMOC(tp), _surfacePosition(NULL)
 {
   // Define number of DOFs
   _numDOF = 2 * tp.numEdges * tp.quadOrder * tp.numGroups;
   _numPhaseSpaceDOF = 2 * tp.numCells * tp.quadOrder * tp.numGroups;
   _numSpaceDOF = tp.numCells;
-  LOG_DBG("num dof = ",_numDOF);
-  LOG_DBG("num space dof = ", tp.numCells);
-
-  mesh = dynamic_cast<MoabMesh*>(_prob.mesh);
-  if (!mesh) {
-    LOG_ERR("This solver needs a MOAB mesh or a mesh interface with integrated sweep methods.");
-    return;
-  }
-
-  // Allocate and initialize solution and source arrays
-  _solution     = new double [_numDOF];
-  _residual     = new double [_numDOF];
-  _solutionPrev = new double [_numDOF];
-  _surfacePosition = new double [_numDOF];
-  _source       = new double [_numPhaseSpaceDOF];
-  _cellFlux     = new double [_numPhaseSpaceDOF];
-  for (long i=0; i<_numDOF; i++) {
-    _solution[i] = 0.0;
-    _solutionPrev[i] = 0.0;
-    _surfacePosition[i] = 0.0;
-  }
-  for (long i=0; i<_numPhaseSpaceDOF; i++) {
-    _source[i] = 0.0;
-    _cellFlux[i] = 1.0;
-  }
-
-  _mapDOFs();
-
-  _calculateSphericalQuadrature();
 }
 
 SolverLocalMOC::~SolverLocalMOC()
 {
-  delete [] _solution;
-  delete [] _residual;
-  delete [] _solutionPrev;
-  //delete [] _surfacePosition;
-  delete [] _source;
-  delete [] _cellFlux;
+  _freeAngularArray(_solution);
+  _freeAngularArray(_residual);
+  _freeAngularArray(_solutionPrev);
+  _freeAngularArray(_surfacePosition);
+  _freeAngularArray(_source);
+  _freeAngularArray(_cellFlux);
 }
 
-/// Map degrees-of-freedom
+/**
+ *  Reflected fluxes are looked up by element rather than by edge, which
+ *  sweep front storage does not keep, so it is limited to vacuum boundaries
+ */
 void
-SolverLocalMOC::_mapDOFs()
+SolverLocalMOC::setupDecomposition()
 {
-  DOFlist.reserve(_numDOF);
-
-  for (long i=0; i<_prob.numCells; i++) {
-    for (int n=0; n<_prob.quadOrder; n++) {
-      for (int g=0; g<_prob.numGroups; g++) {
-        DOFlist.push_back( DOFObj(i,n,g) );
-        DOFmap.insert( std::pair<DOFObj, double*>(DOFlist[_dofIndex(i,n,g)], &_solution[_dofIndex(i,n,g)]) );
-      }
-    }
+  if (_sweepFrontStorage && _prob.globalBC != vacuum) {
+    LOG_ERR("Sweep front storage of the LocalMOC solver needs vacuum boundaries; storing all edges.");
+    _sweepFrontStorage = false;
   }
+  SolverMOC::setupDecomposition();
 }
 
-/// Get spherical representation of ordinates
+/// Allocate solution and source arrays
 /**
- *  Calculate (theta, mu) coordinates from the input (omega_x, omega_y, omega_z).
- *  Also get the mapping between each ordinate, u, and its negative, -v.  Currently
- *  only two-dimensional problems are assumed, so the polar cosine, mu, is assumed
- *  symmetric about the xy-plane.
+ *  They are initialized (first touched) by setupDecomposition once the thread
+ *  decomposition is known.  The arrays only hold the stored groups.  The DOF
+ *  map is skipped out of core and with group block or sweep front storage.
  */
 void
-SolverLocalMOC::_calculateSphericalQuadrature()
+SolverLocalMOC::_allocateStorage()
 {
-  // Polar coordinate
-  _mu = _prob.omega_z;
-
-  // Azimuthal coordinate
-  _theta.resize(_prob.quadOrder, 0.0);
-  for (int i=0; i<_prob.quadOrder; i++)
-    _theta[i] = _getAngleFromVector(_prob.omega_x[i], _prob.omega_y[i]);
-
-  // Aggregate azimuthal negative directions
-  _negDir.resize(_prob.quadOrder, -1);
-  for (int i=0; i<_prob.quadOrder; i++) {
-    bool found;
-    found = false;
-    int j;
-    for (j=0; j<_prob.quadOrder; j++) {
-      if (_mu[i] == _mu[j]) {
-        if ( std::abs(_theta[i] - fmod(_theta[j] + pi, 2*pi)) < 1e-8) {
-          found = true;
-          break;
-        }
-      }
-    }
-    if (!found)
-      LOG_ERR("Could not find negative direction for ordinate ", i);
-    else
-      _negDir[i] = j;
-  }
-}
+  _numDOF = _numEdgeDOFs();
+  _numPhaseSpaceDOF = 2 * _numLocalCells * _prob.quadOrder * _numStoredGroups;
+  LOG_DBG("num dof = ",_numDOF);
+  LOG_DBG("num space dof = ", _prob.numCells);
 
-int
-SolverLocalMOC::_getReflectedDirection(int i, double nx, double ny, double& OmegaDotn)
-{
-  double Omegapx = -2.0*OmegaDotn*nx + sqrt(1.0-pow(_mu[i],2))*cos(_theta[i]);
-  double Omegapy = -2.0*OmegaDotn*ny + sqrt(1.0-pow(_mu[i],2))*sin(_theta[i]);
-  double thetap = _getAngleFromVector(Omegapx, Omegapy);
-
-  bool found;
-  found = false;
-  int j;
-  for (j=0; j<_prob.quadOrder; j++) {
-    if (_mu[j] == _mu[i]) {
-      if ( std::abs(_theta[j] - thetap) < 1e-8) {
-        found = true;
-        break;
-      }
-    }
-  }
-  if (!found) {
-    LOG_ERR("Could not find reflected direction for ordinate ", i);
-    LOG_DBG(nx," ",ny);
-    LOG_DBG(Omegapx," ",Omegapy);
-    return -1;
-  }
-  else
-    return j;
+  _solution     = _allocateAngularArray(_numDOF);
+  _residual     = _allocateAngularArray(_numDOF);
+  _solutionPrev = _allocateAngularArray(_numDOF);
+  _surfacePosition = _allocateAngularArray(_numDOF);
+  _source       = _allocateAngularArray(_numPhaseSpaceDOF);
+  _cellFlux     = _allocateAngularArray(_numPhaseSpaceDOF);
+
+  if (_outOfCoreDirectory.empty() && !_groupBlockStorage() && !_sweepFrontStorage)
+    _mapDOFs();
+
+  // Interface fluxes are interpolated with the upwind surface positions
+  _interfaceArrays.push_back(_surfacePosition);
 }
 
-/// Implementation of the LocalMOC solver
+/// Map degrees-of-freedom
 void
-SolverLocalMOC::solve()
+SolverLocalMOC::_mapDOFs()
 {
-  PerfStats X("SolverLocalMOC::solve");
-
-  double convRInf;
-  int innerIter;
-  int scatterIter;
-  int fissionIter;
-  double* fissionSrcFlux = NULL;
-
-  sourceConfig.hasFissionSource = false;
-  
-  convRInf = 1.0e10;
-
-  for (fissionIter=0; fissionIter<_maxIters; fissionIter++) {
-    if (sourceConfig.hasFissionSource)
-      fissionSrcFlux = copySolution(fissionSrcFlux);
-    else
-      fissionSrcFlux = _solution;
-
-    // Perform scattering iterations
-    for (scatterIter=0; scatterIter<_maxIters; scatterIter++) {
-      _saveOldSolution();
-      _calculateSource(fissionSrcFlux);
-      _applyBoundaryConditions();
-      #pragma omp parallel for
-      for (int n=0; n<_prob.quadOrder; n++)
-        _sweep(n);
-      // Test for convergence of inner iterations
-      convRInf = calculateRInfSolutionNorm(_solutionPrev);
-      if (convRInf < _convRInfTol) break;
+  DOFlist.reserve(_numDOF);
+
+  for (long i=0; i<_prob.numCells; i++) {
+    if (!_storesCell(i)) continue;
+    for (int n=0; n<_prob.quadOrder; n++) {
+      for (int g=0; g<_prob.numGroups; g++) {
+        DOFlist.push_back( DOFObj(i,n,g) );
+        DOFmap.insert( std::pair<DOFObj, double*>(DOFlist.back(), &_solution[_dofIndex(i,n,g)]) );
+      }
     }
-    // Test for convergence of fission iterations
-    printIterStatus("scatter", scatterIter, convRInf, _convRInfTol);
-    convRInf = calculateRInfSolutionNorm(fissionSrcFlux);
-    if (convRInf < _convRInfTol) break;
   }
-  //printIterStatus("fission", fissionIter, convRInf, _convRInfTol);
-  if (sourceConfig.hasFissionSource)
-    delete [] fissionSrcFlux;
 }
 
-/// Mesh sweep
-/**
- *  A MoabMesh must be used.
- */
+/// Solve all active groups of one element for every batched source
 void
-SolverLocalMOC::_sweep(int n)
+SolverLocalMOC::_solveElement(UltraLightElement& element, long elementID, int n,
+                              int firstGroup, int lastGroup)
 {
-  UltraLightElement element;
-  long elementID;
-  long id[3];
-  long neighbor[3];
-  Sweeper sweep(mesh, n);
-  while ((elementID = sweep.getNextElementID()) >=0 ) {
-    mesh->getCurrentElementFromID(elementID, element);
-
-    double mu01,mu12,mu20;
-    double pathDist;
-    int evDir,veDir;
-    long edgeNeighbor,vertexNeighbor1,vertexNeighbor2;
-    int xedge, v0,v1,v2;
-    double surfacePosition;
-    _getTriangleOrientation(element, n,
-                            mu01, mu12, mu20,
-                            pathDist, evDir, veDir,
-                            edgeNeighbor, vertexNeighbor1, vertexNeighbor2,
-                            xedge,v0,v1,v2,surfacePosition);
-          
-    // Do calculation here
-    for (int g=0; g<_prob.numGroups; g++) {
+  double mu01,mu12,mu20;
+  double pathDist;
+  int evDir,veDir;
+  long edgeNeighbor,vertexNeighbor1,vertexNeighbor2;
+  int xedge, v0,v1,v2;
+  double surfacePosition;
+  _getTriangleOrientation(element, n,
+                          mu01, mu12, mu20,
+                          pathDist, evDir, veDir,
+                          edgeNeighbor, vertexNeighbor1, vertexNeighbor2,
+                          xedge,v0,v1,v2,surfacePosition);
+        
+  // Do calculation here; batched sources share the orientation
+  for (int b=0; b<_numBatchedSources; b++) {
+    double* solution = _batchedSolution(b);
+    const double* source = _batchedSource(b);
+    double* cellFlux = _batchedCellFlux(b);
+    for (int g=firstGroup; g<lastGroup; g++) {
+      if (!_groupActive[g]) continue;
       // Do edge to vertex characteristic
       double psi0,psi1,psi2,psi12,psi01,psi20, q, att,expatt, sigma;
       long edgeIndex;
+      double* edgeFlux;
       sigma = *mesh->getElementMat(elementID)->getSigma_t(g+1);
       att = pathDist/sqrt(1.0 - pow(_mu[n],2));
       expatt = exp(-sigma*att);
 
       if (evDir==n) {
         // Do edge to vertex characteristic
-	double sp,psi12l,psi12r;
+        double sp,psi12l,psi12r;
         if (edgeNeighbor >= 0) {
-	  edgeIndex = mesh->getEdgeID(elementID, edgeNeighbor);
-	  sp = _surfacePosition[ _dofIndex(edgeIndex,evDir,g) ];
-	  psi12l = _solution[ _dofIndex(edgeIndex,evDir,g,0) ];
-	  psi12r = _solution[ _dofIndex(edgeIndex,evDir,g,1) ];
-	  if (surfacePosition <= sp) {
-	    psi12r = ((sp-surfacePosition)*psi12l + (1-sp)*psi12r)/(1-surfacePosition);
-	    psi12l = psi12l;
-	  }
-	  else {
-	    psi12l = (sp*psi12l + (surfacePosition-sp)*psi12r)/surfacePosition;
-	    psi12r = psi12r;
-	  }
-	}
+          edgeIndex = mesh->getEdgeID(elementID, edgeNeighbor);
+          sp = _surfacePosition[ _edgeDOFIndex(edgeIndex,evDir,g) ];
+          psi12l = solution[ _edgeDOFIndex(edgeIndex,evDir,g,0) ];
+          psi12r = solution[ _edgeDOFIndex(edgeIndex,evDir,g,1) ];
+          if (surfacePosition <= sp) {
+            psi12r = ((sp-surfacePosition)*psi12l + (1-sp)*psi12r)/(1-surfacePosition);
+            psi12l = psi12l;
+          }
+          else {
+            psi12l = (sp*psi12l + (surfacePosition-sp)*psi12r)/surfacePosition;
+            psi12r = psi12r;
+          }
+        }
         else {
           psi12l = _bdryFlux[DOFObj(3*elementID,n,g)];
           psi12r = _bdryFlux[DOFObj(3*elementID,n,g)];
         }
-        
-        q = _source[ _dofIndex(elementID,evDir,g) ];
+      
+        q = source[ _dofIndex(elementID,evDir,g) ];
 
-	edgeIndex = mesh->getEdgeID(vertexNeighbor1,elementID);
+        // Outgoing edge DOFs; _surfacePosition is interface array 1
+        edgeIndex = mesh->getEdgeID(vertexNeighbor1,elementID);
         psi0 = expatt*psi12r + (1.0 - expatt)/sigma*q;
-        _solution[ _dofIndex(edgeIndex,evDir,g,0) ] = (psi12r - psi0)/(sigma*att) + q/sigma;
-        _solution[ _dofIndex(edgeIndex,evDir,g,1) ] = (psi12r - psi0)/(sigma*att) + q/sigma;
-	_surfacePosition[ _dofIndex(edgeIndex,evDir,g) ] = 0.5;
+        edgeFlux = _outgoingBatchedDOFs(edgeIndex,evDir,g,b);
+        edgeFlux[0] = (psi12r - psi0)/(sigma*att) + q/sigma;
+        edgeFlux[1] = (psi12r - psi0)/(sigma*att) + q/sigma;
+        _outgoingEdgeDOFs(edgeIndex,evDir,g,1)[0] = 0.5;
 
-	edgeIndex = mesh->getEdgeID(vertexNeighbor2,elementID);
+        edgeIndex = mesh->getEdgeID(vertexNeighbor2,elementID);
         psi0 = expatt*psi12l + (1.0 - expatt)/sigma*q;
-        _solution[ _dofIndex(edgeIndex,evDir,g,0) ] = (psi12l - psi0)/(sigma*att) + q/sigma;
-        _solution[ _dofIndex(edgeIndex,evDir,g,1) ] = (psi12l - psi0)/(sigma*att) + q/sigma;
-	_surfacePosition[ _dofIndex(edgeIndex,evDir,g) ] = 0.5;
+        edgeFlux = _outgoingBatchedDOFs(edgeIndex,evDir,g,b);
+        edgeFlux[0] = (psi12l - psi0)/(sigma*att) + q/sigma;
+        edgeFlux[1] = (psi12l - psi0)/(sigma*att) + q/sigma;
+        _outgoingEdgeDOFs(edgeIndex,evDir,g,1)[0] = 0.5;
 
-	psi12 = surfacePosition*psi12l + (1-surfacePosition)*psi12r;
+        psi12 = surfacePosition*psi12l + (1-surfacePosition)*psi12r;
         psi0 = expatt*psi12 + (1.0 - expatt)/sigma*q;
-        _cellFlux[ _dofIndex(elementID,evDir,g) ] = (psi12 - ((psi12 - psi0)/(sigma*att) + q/sigma))*2/(sigma*att) + q/sigma;
+        cellFlux[ _dofIndex(elementID,evDir,g) ] = (psi12 - ((psi12 - psi0)/(sigma*att) + q/sigma))*2/(sigma*att) + q/sigma;
       }
       else {
         // Do vertex to edge characteristic
-	double sp;
+        double sp;
         if (vertexNeighbor1 >= 0) {
-	  edgeIndex = mesh->getEdgeID(elementID,vertexNeighbor1);
-	  sp = _surfacePosition[ _dofIndex(edgeIndex,veDir,g) ];
-          psi20 = _solution[ _dofIndex(edgeIndex,veDir,g,0) ]*sp;
-	  psi20 += _solution[ _dofIndex(edgeIndex,veDir,g,1) ]*(1.0-sp);
-	}
+          edgeIndex = mesh->getEdgeID(elementID,vertexNeighbor1);
+          sp = _surfacePosition[ _edgeDOFIndex(edgeIndex,veDir,g) ];
+          psi20 = solution[ _edgeDOFIndex(edgeIndex,veDir,g,0) ]*sp;
+          psi20 += solution[ _edgeDOFIndex(edgeIndex,veDir,g,1) ]*(1.0-sp);
+        }
         else {
           psi20 = _bdryFlux[DOFObj(3*elementID+1,n,g)];
         }
         if (vertexNeighbor2 >= 0) {
-	  edgeIndex = mesh->getEdgeID(elementID,vertexNeighbor2);
-	  sp = _surfacePosition[ _dofIndex(edgeIndex,veDir,g) ];
-          psi01 = _solution[ _dofIndex(edgeIndex,veDir,g,0) ]*sp;
-          psi01 += _solution[ _dofIndex(edgeIndex,veDir,g,1) ]*(1.0-sp);
-	}
+          edgeIndex = mesh->getEdgeID(elementID,vertexNeighbor2);
+          sp = _surfacePosition[ _edgeDOFIndex(edgeIndex,veDir,g) ];
+          psi01 = solution[ _edgeDOFIndex(edgeIndex,veDir,g,0) ]*sp;
+          psi01 += solution[ _edgeDOFIndex(edgeIndex,veDir,g,1) ]*(1.0-sp);
+        }
         else {
           psi01 = _bdryFlux[DOFObj(3*elementID+2,n,g)];
         }
-        
-        q = _source[ _dofIndex(elementID,veDir,g) ];
+      
+        q = source[ _dofIndex(elementID,veDir,g) ];
 
-	edgeIndex = mesh->getEdgeID(edgeNeighbor,elementID);
-	// Left side
+        edgeIndex = mesh->getEdgeID(edgeNeighbor,elementID);
+        edgeFlux = _outgoingBatchedDOFs(edgeIndex,veDir,g,b);
+        // Left side
         psi12 = expatt*psi20 + (1.0 - expatt)/sigma*q;
-        _solution[ _dofIndex(edgeIndex,veDir,g,0) ] = (psi20 - psi12)/(sigma*att) + q/sigma;
-	// Right side
+        edgeFlux[0] = (psi20 - psi12)/(sigma*att) + q/sigma;
+        // Right side
         psi12 = expatt*psi01 + (1.0 - expatt)/sigma*q;
-        _solution[ _dofIndex(edgeIndex,veDir,g,1) ] = (psi01 - psi12)/(sigma*att) + q/sigma;
-	_surfacePosition[ _dofIndex(edgeIndex,veDir,g) ] = surfacePosition;
+        edgeFlux[1] = (psi01 - psi12)/(sigma*att) + q/sigma;
+        _outgoingEdgeDOFs(edgeIndex,veDir,g,1)[0] = surfacePosition;
 
         psi0 = (mu20*psi20 + mu01*psi01) / mu12;
         psi12 = expatt*psi0 + (1.0 - expatt)/sigma*q;
-        _cellFlux[ _dofIndex(elementID,veDir,g) ] = (psi0 - ((psi0 - psi12)/(sigma*att) + q/sigma))*2/(sigma*att) + q/sigma;
+        cellFlux[ _dofIndex(elementID,veDir,g) ] = (psi0 - ((psi0 - psi12)/(sigma*att) + q/sigma))*2/(sigma*att) + q/sigma;
       }
     } // loop over groups
-  } // loop over elements
-
+  } // loop over batched sources
 }
 
 void
@@ -480,21 +381,21 @@ SolverLocalMOC::_getTriangleOrientation(UltraLightElement &element, int n,
 }
 
 void
-SolverLocalMOC::_applyBoundaryConditions()
+SolverLocalMOC::_buildBoundaryPlan()
 {
-  UltraLightElement element;
-  int nxtNghbr[3] = {1, 2, 0};
-  int* n = new int [4];
+  _initializeBoundaryPlan();
 
+  UltraLightElement element;
   // Loop over all boundary elements
   for (long be=0; be < mesh->boundaryElements.size(); be++) {
     long elementID = mesh->boundaryElements[be];
+    if (!_ownsCell(elementID)) continue;
     
     // Get current element
     mesh->getCurrentElementFromID(elementID, element);
 
     // Loop over all directions
-    for (int n=0; n<_theta.size(); n++) {
+    for (int n=0; n<_prob.quadOrder; n++) {
       double mu01,mu12,mu20;
       double pathDist;
       int evDir,veDir;
@@ -532,23 +433,24 @@ SolverLocalMOC::_applyBoundaryConditions()
           if (_prob.globalBC == reflecting) {
             int np = _getReflectedDirection(n, nx, ny, OmegaDotN);
             for (int g=0; g<_prob.numGroups; g++) 
-              _bdryFlux[DOFObj(3*elementID,n,g)] = _solution[ _dofIndex(elementID,np,g) ];
+              _addBoundaryPlanEntry(n, DOFObj(3*elementID,n,g), _dofIndex(elementID,np,g));
           }
           else if (_prob.globalBC == vacuum) {
             for (int g=0; g<_prob.numGroups; g++) 
-              _bdryFlux[DOFObj(3*elementID,n,g)] = 0.0;
+              _addBoundaryPlanEntry(n, DOFObj(3*elementID,n,g), &_zeroBoundaryFlux);
           }
-          else if (_prob.globalBC == source) {
+          else if (_prob.globalBC == source &&
+                   !_addFileBoundarySource(n, mesh->getEdgeID(elementID,edgeNeighbor), 3*elementID, 1)) {
             for (int bi=0; bi<_prob.nxnyq.size(); bi+=3) {
               if (std::abs(nx-_prob.nxnyq[bi]) < 1.0e-8 && std::abs(ny-_prob.nxnyq[bi+1]) < 1.0e-8) {
 		if (_prob.nxnyq[bi+2]<0.0) {
 		  int np = _getReflectedDirection(n, nx, ny, OmegaDotN);
 		  for (int g=0; g<_prob.numGroups; g++) 
-		    _bdryFlux[DOFObj(3*elementID,n,g)] = _solution[ _dofIndex(elementID,np,g) ];
+		    _addBoundaryPlanEntry(n, DOFObj(3*elementID,n,g), _dofIndex(elementID,np,g));
 		}
 		else {
 		  for (int g=0; g<_prob.numGroups; g++)
-		    _bdryFlux[DOFObj(3*elementID,n,g)] = _prob.nxnyq[bi+2];
+		    _addBoundaryPlanEntry(n, DOFObj(3*elementID,n,g), &_prob.nxnyq[bi+2]);
 		}
 	      }
             }
@@ -581,23 +483,24 @@ SolverLocalMOC::_applyBoundaryConditions()
             if (_prob.globalBC == reflecting) {
               int np = _getReflectedDirection(n, nx, ny, OmegaDotN);
               for (int g=0; g<_prob.numGroups; g++) 
-                _bdryFlux[DOFObj(3*elementID+1,n,g)] = _solution[ _dofIndex(elementID,np,g) ];
+                _addBoundaryPlanEntry(n, DOFObj(3*elementID+1,n,g), _dofIndex(elementID,np,g));
             }
             else if (_prob.globalBC == vacuum) {
               for (int g=0; g<_prob.numGroups; g++) 
-                _bdryFlux[DOFObj(3*elementID+1,n,g)] = 0.0;
+                _addBoundaryPlanEntry(n, DOFObj(3*elementID+1,n,g), &_zeroBoundaryFlux);
             }
-            else if (_prob.globalBC == source) {
+            else if (_prob.globalBC == source &&
+                     !_addFileBoundarySource(n, mesh->getEdgeID(elementID,vertexNeighbor1), 3*elementID+1, 1)) {
               for (int bi=0; bi<_prob.nxnyq.size(); bi+=3) {
                 if (std::abs(nx-_prob.nxnyq[bi]) < 1.0e-8 && std::abs(ny-_prob.nxnyq[bi+1]) < 1.0e-8) {
 		  if (_prob.nxnyq[bi+2]<0.0) {
 		    int np = _getReflectedDirection(n, nx, ny, OmegaDotN);
 		    for (int g=0; g<_prob.numGroups; g++) 
-		      _bdryFlux[DOFObj(3*elementID+1,n,g)] = _solution[ _dofIndex(elementID,np,g) ];
+		      _addBoundaryPlanEntry(n, DOFObj(3*elementID+1,n,g), _dofIndex(elementID,np,g));
 		  }
 		  else{
 		    for (int g=0; g<_prob.numGroups; g++)
-		      _bdryFlux[DOFObj(3*elementID+1,n,g)] = _prob.nxnyq[bi+2];
+		      _addBoundaryPlanEntry(n, DOFObj(3*elementID+1,n,g), &_prob.nxnyq[bi+2]);
 		  }
 		}
               }
@@ -627,23 +530,24 @@ SolverLocalMOC::_applyBoundaryConditions()
             if (_prob.globalBC == reflecting) {
               int np = _getReflectedDirection(n, nx, ny, OmegaDotN);
               for (int g=0; g<_prob.numGroups; g++)
-                _bdryFlux[DOFObj(3*elementID+2,n,g)] = _solution[ _dofIndex(elementID,np,g) ];
+                _addBoundaryPlanEntry(n, DOFObj(3*elementID+2,n,g), _dofIndex(elementID,np,g));
             }
             else if (_prob.globalBC == vacuum) {
               for (int g=0; g<_prob.numGroups; g++) 
-                _bdryFlux[DOFObj(3*elementID+2,n,g)] = 0.0;
+                _addBoundaryPlanEntry(n, DOFObj(3*elementID+2,n,g), &_zeroBoundaryFlux);
             }
-            else if (_prob.globalBC == source) {
+            else if (_prob.globalBC == source &&
+                     !_addFileBoundarySource(n, mesh->getEdgeID(elementID,vertexNeighbor2), 3*elementID+2, 1)) {
               for (int bi=0; bi<_prob.nxnyq.size(); bi+=3) {
                 if (std::abs(nx-_prob.nxnyq[bi]) < 1.0e-8 && std::abs(ny-_prob.nxnyq[bi+1]) < 1.0e-8) {
 		  if (_prob.nxnyq[bi+2]<0.0) {
 		    int np = _getReflectedDirection(n, nx, ny, OmegaDotN);
 		    for (int g=0; g<_prob.numGroups; g++)
-		      _bdryFlux[DOFObj(3*elementID+2,n,g)] = _solution[ _dofIndex(elementID,np,g) ];
+		      _addBoundaryPlanEntry(n, DOFObj(3*elementID+2,n,g), _dofIndex(elementID,np,g));
 		  }
 		  else {
 		    for (int g=0; g<_prob.numGroups; g++)
-		      _bdryFlux[DOFObj(3*elementID+2,n,g)] = _prob.nxnyq[bi+2];
+		      _addBoundaryPlanEntry(n, DOFObj(3*elementID+2,n,g), &_prob.nxnyq[bi+2]);
 		  }
 		}
               }
@@ -653,85 +557,16 @@ SolverLocalMOC::_applyBoundaryConditions()
       }
     }
   }
-  delete [] n;
-}
-
-
-/// Calculate the azimuthal angle of a vector with components dx and dy
-double
-SolverLocalMOC::_getAngleFromVector(double dx, double dy)
-{
-  double phi;
-  if (std::abs(dx) < 1.0e-8) {
-    if (dy > 0.0)
-      phi = pi/2;
-    else
-      phi = 3*pi/2;
-  }
-  else {
-    phi = fmod(2.0*pi + atan2(dy,dx), 2.0*pi);
-  }
-  return phi;
-}
-
-void
-SolverLocalMOC::_calculateSource(double* fissionFlux)
-{
-  PerfStats X("SolverLocalMOC::_calculateSource");
-
-  _getExternalSource();
-  //  _addFissionSource(fissionFlux);
-  _addScatterSource();
-}
-
-void
-SolverLocalMOC::_getExternalSource()
-{
-  // Get external source
-  if (sourceConfig.hasExternalSource) {
-    #pragma omp parallel for
-    for (long i=0; i<_prob.numCells; i++) {
-      for (int n=0; n<_prob.quadOrder; n++) {
-        for (int g=0; g<_prob.numGroups; g++) {
-          _source[_dofIndex(i,n,g)] = *_prob.getExtSource(i,n,g) * sourceScaling;
-        }
-      }
-    }
-  }
-  else {
-    for (long i=0; i<_numDOF; i++)
-      _source[i] = 0.0;
-  }
-}
-
-void
-SolverLocalMOC::_addScatterSource()
-{
-  // Currently only isotropic scattering is supported
-  double scattXS, scalFlux;
-
-  #pragma omp parallel for private(scattXS,scalFlux)
-  for (long i=0; i<_prob.numCells; i++) {
-    for (int gp=0; gp<_prob.numGroups; gp++) {
-      scalFlux = getScalarFlux(i, gp);
-      for (int g=0; g<_prob.numGroups; g++) {
-        scattXS = *mesh->getElementMat(i)->getSigma_s(gp+1,g+1);
-        for (int n=0; n<_prob.quadOrder; n++)
-          _source[_dofIndex(i,n,g)] += scalFlux*scattXS;
-      }
-    }
-  }
-}
-
-
-void
-SolverLocalMOC::_calculateMatrixAction(double* x, double* y)
-{
 }
 
 double
 SolverLocalMOC::getScalarFlux(long space_i, int group_g)
 {
+  if (_reducedScalarFluxValid)
+    return _reducedScalarFlux[space_i*_prob.numGroups + group_g];
+  if (!_storesCell(space_i))
+    return 0.0;
+
   double scalarFlux = 0;
   double sumOfWeights = 0;
   for (int n=0; n<_prob.quadOrder; n++) {
@@ -0,0 +1,1859 @@
+#include "solvermoc.h"
+#include "global.h"
+#include "sweeper.h"
+#include "timing.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <thread>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+SolverMOC::SolverMOC(TransportProblem &tp)
+  : SolverBase(tp), _groupBlockSize(0), _groupBlockSizeTuned(false), _numBatchedSources(1),
+    _activeSource(0), _numEdgeSlots(0), _numLocalCells(tp.numCells), _numLocalEdges(tp.numEdges),
+    _decompositionInitialized(false), _numSubdomains(1)
+{
+  _solution = _solutionPrev = _residual = NULL;
+  _source = NULL;
+
+  mesh = dynamic_cast<MoabMesh*>(_prob.mesh);
+  if (!mesh)
+    LOG_ERR("This solver needs a MOAB mesh or a mesh interface with integrated sweep methods.");
+
+  _calculateSphericalQuadrature();
+}
+
+/**
+ *  Free the staging buffers of subdomain sweeps and the arrays of batched
+ *  sources other than the active one (the solver's own angular arrays are
+ *  freed by each method)
+ */
+SolverMOC::~SolverMOC()
+{
+  for (int a=0; a<_stagedEdgeFlux.size(); a++)
+    delete [] _stagedEdgeFlux[a];
+
+  for (int s=0; s<_batchedArrays.size(); s++) {
+    if (s == _activeSource) continue;
+    BatchedSourceArrays& arrays = _batchedArrays[s];
+    _freeAngularArray(arrays.solution);
+    _freeAngularArray(arrays.solutionPrev);
+    _freeAngularArray(arrays.source);
+    _freeAngularArray(arrays.cellFlux);
+    if (arrays.scalarFlux) delete [] arrays.scalarFlux;
+    if (arrays.scalarFluxPrev) delete [] arrays.scalarFluxPrev;
+  }
+}
+
+/// Source iteration shared by the MOC solvers
+void
+SolverMOC::solve()
+{
+  PerfStats X("SolverMOC::solve");
+
+  double convRInf = 1e10;
+  int scatterIter;
+  int fissionIter;
+
+  setupDecomposition();
+  _initializeInnerTolerance();
+  if (sourceConfig.hasFissionSource)
+    _initializeFissionIteration();
+
+  for (fissionIter=0; fissionIter<_maxIters; fissionIter++) {
+    // A new fission source may change any group
+    _initializeGroupConvergence();
+
+    // Perform scattering iterations
+    if (_groupBlockStorage()) {
+      convRInf = _groupBlockIterations(scatterIter);
+    }
+    else if (_numBatchedSources > 1) {
+      convRInf = _batchedSourceIterations(scatterIter);
+    }
+    else {
+      for (scatterIter=0; scatterIter<_maxIters; scatterIter++) {
+        _saveOldFlux();
+        _calculateSource();
+        _sweepAllDirections();
+        // Test for convergence of inner iterations
+        convRInf = _updateGroupConvergence();
+        if (convRInf < _innerTol) break;
+      }
+    }
+    // Test for convergence of fission iterations
+    printIterStatus("scatter", scatterIter, convRInf, _innerTol);
+    if (!sourceConfig.hasFissionSource) break;
+    if (_updateFissionIteration(fissionIter)) break;
+  }
+
+  _restoreSolutionStorage();
+  _gatherSolution();
+}
+
+/// One transport sweep of all directions and stored groups
+void
+SolverMOC::_sweepAllDirections()
+{
+  if (_numSubdomains > 1) {
+    _applyBoundaryConditions();
+    _sweepSubdomains();
+  }
+  else if (_reflectionSets.size() > 0) {
+    // The plan is rebuilt after a group block change; do it before the threads share it
+    if (_bcPlan.size() == 0)
+      _buildBoundaryPlan();
+
+    // Reflected directions are swept in sequence using fresh boundary fluxes
+    #pragma omp parallel for schedule(dynamic)
+    for (int r=0; r<_reflectionSets.size(); r++) {
+      for (int k=0; k<_reflectionSets[r].size(); k++) {
+        _applyBoundaryConditions(_reflectionSets[r][k]);
+        _sweep(_reflectionSets[r][k], _firstStoredGroup, _endStoredGroup());
+      }
+    }
+  }
+  else {
+    _applyBoundaryConditions();
+    _sweepAngleGroupBlocks();
+    if (_reflectiveSweepOrder)
+      _buildReflectionSets();
+  }
+  _exchangeInterfaceFlux();
+  _reduceAngularFlux();
+  _numSweeps++;
+}
+
+/// Mesh sweep
+/**
+ *  Visits the elements in the sweep order of direction n and solves each one
+ *  with the method's element kernel.
+ */
+void
+SolverMOC::_sweep(int n, int firstGroup, int lastGroup)
+{
+  if (!_ownsDirection(n))
+    return;
+
+  UltraLightElement element;
+  long elementID;
+  Sweeper sweep(mesh, n + _prob.sweepOrderOffset);
+  while ((elementID = sweep.getNextElementID()) >= 0) {
+    if (!_ownsCell(elementID)) continue;
+    mesh->getCurrentElementFromID(elementID, element);
+    _solveElement(element, elementID, n, firstGroup, lastGroup);
+  }
+}
+
+/// Sweep all directions as (direction, group block) tasks
+/**
+ *  With fewer directions than threads each direction is split into group
+ *  blocks so that there are about two tasks per thread.  The per-group cost
+ *  of the first sweep is then measured and the blocks are enlarged if a task
+ *  would be too short to hide the scheduling and element geometry overhead
+ *  that every task repeats.  Tasks are handed out dynamically, since
+ *  directions do not all cost the same (e.g. reflected or idle directions).
+ */
+void
+SolverMOC::_sweepAngleGroupBlocks()
+{
+  const double minTaskTime = 2.0e-4;  // seconds
+  int G = _numStoredGroups;
+
+  std::vector<int> directions;
+  for (int n=0; n<_prob.quadOrder; n++)
+    if (_ownsDirection(n))
+      directions.push_back(n);
+  if (directions.size() == 0)
+    return;
+
+  int numThreads = 1;
+#ifdef _OPENMP
+  numThreads = omp_get_max_threads();
+#endif
+  if (_groupBlockSize == 0) {
+    int blocksPerDirection = std::min(G, (2*numThreads + (int)directions.size() - 1)/(int)directions.size());
+    _groupBlockSize = (G + blocksPerDirection - 1)/blocksPerDirection;
+    _groupBlockSizeTuned = (_groupBlockSize == G);
+    if (!_groupBlockSizeTuned)
+      LOG("Sweeping ", directions.size(), " directions in blocks of ", _groupBlockSize, " groups.");
+  }
+
+  // Geometry of shared per-direction data is set up before the tasks
+  #pragma omp parallel for
+  for (int k=0; k<directions.size(); k++)
+    _prepareSweep(directions[k]);
+
+  // Out of core, directions are swept in blocks while the pages of the next
+  // block are read in the background.  By default a block spans at least a
+  // page of each edge.
+  int angleBlockSize = directions.size();
+  if (_mappedArrays.size() > 0) {
+    long pageDirections = sysconf(_SC_PAGESIZE)/(2*_numStoredGroups*sizeof(double));
+    angleBlockSize = (_angleBlockSize > 0) ? _angleBlockSize : std::max((long)numThreads, pageDirections);
+  }
+
+  int blocksPerDirection = (G + _groupBlockSize - 1)/_groupBlockSize;
+  double taskTime = 0.0;
+  for (int firstDirection=0; firstDirection<directions.size(); firstDirection+=angleBlockSize) {
+    int lastDirection = std::min((int)directions.size(), firstDirection + angleBlockSize);
+    std::thread prefetch;
+    if (lastDirection < directions.size()) {
+      int nextLast = std::min((int)directions.size(), lastDirection + angleBlockSize);
+      prefetch = std::thread(&SolverMOC::_prefetchDirections, this,
+                             directions[lastDirection], directions[nextLast-1] + 1);
+    }
+
+    int firstTask = firstDirection*blocksPerDirection;
+    int lastTask = lastDirection*blocksPerDirection;
+    #pragma omp parallel for schedule(dynamic) reduction(+:taskTime)
+    for (int t=firstTask; t<lastTask; t++) {
+      int n = directions[t/blocksPerDirection];
+      int firstGroup = _firstStoredGroup + (t % blocksPerDirection)*_groupBlockSize;
+      int lastGroup = std::min(_endStoredGroup(), firstGroup + _groupBlockSize);
+      if (firstGroup >= lastGroup) continue;
+#ifdef _OPENMP
+      double start = omp_get_wtime();
+      _sweep(n, firstGroup, lastGroup);
+      taskTime += omp_get_wtime() - start;
+#else
+      _sweep(n, firstGroup, lastGroup);
+#endif
+    }
+
+    if (prefetch.joinable())
+      prefetch.join();
+  }
+
+  if (!_groupBlockSizeTuned) {
+    _groupBlockSizeTuned = true;
+    double groupTime = taskTime/(directions.size()*G);
+    if (groupTime*_groupBlockSize < minTaskTime) {
+      _groupBlockSize = (groupTime*G > minTaskTime) ? (int)std::ceil(minTaskTime/groupTime) : G;
+      LOG("Measured ", groupTime, " s per direction and group; sweeping in blocks of ", _groupBlockSize, " groups.");
+    }
+  }
+}
+
+/// Decompose the problem, then allocate and initialize the solver arrays
+/**
+ *  The arrays are allocated here, once the storage settings are applied, and
+ *  first written once the decomposition is known, so each page is placed on
+ *  the NUMA node of the thread that sweeps it.
+ */
+void
+SolverMOC::setupDecomposition()
+{
+  if (_decompositionInitialized)
+    return;
+  if (_groupBlockStorage())
+    _initializeGroupBlockStorage();
+  if (_sweepFrontStorage)
+    _buildSweepFront();
+  _partitionMesh();
+  _buildLocalStorage();
+  _allocateStorage();
+  if (_mappedArrays.size() > 0) {
+    long size = 0;
+    for (std::map<double*, long>::iterator it=_mappedArrays.begin(); it!=_mappedArrays.end(); ++it)
+      size += it->second;
+    LOG("Keeping ", size*sizeof(double)/1.0e9, " GB of angular fluxes out of core in ", _outOfCoreDirectory, ".");
+    if (2*_numStoredGroups*_prob.quadOrder*sizeof(double) < sysconf(_SC_PAGESIZE))
+      LOG_WARN("All directions of an edge share a page, so every direction block is resident; ",
+               "out of core only pays off for many groups.");
+  }
+  _initializeDecomposition();
+  _placeStorage();
+  if (_autoThreading) {
+    // Trial sweeps overwrite the arrays
+    _selectSweepStrategy();
+    _placeStorage();
+  }
+}
+
+/// Set up the decomposition across MPI ranks and threads
+/**
+ *  Directions are split across ranks if an angular decomposition was
+ *  requested, otherwise the mesh is.  With subdomain threading the cells of
+ *  each rank are further split among the threads.
+ */
+void
+SolverMOC::_initializeDecomposition()
+{
+  if (_decompositionInitialized)
+    return;
+  _decompositionInitialized = true;
+
+  if (Parallel::size() == 1)
+    _angularDecomposition = false;
+  if (_angularDecomposition && Parallel::size() > _prob.quadOrder)
+    LOG_WARN("More MPI ranks (", Parallel::size(), ") than directions (", _prob.quadOrder, "); some ranks are idle.");
+
+  if (_threadSubdomains)
+    _buildSubdomains();
+  if (Parallel::size() == 1 || _angularDecomposition)
+    return;
+
+  _buildInterfaceExchange();
+}
+
+/// Partition the mesh across ranks (and threads, with subdomain threading)
+/**
+ *  With subdomain threading the mesh is cut once into (ranks x threads)
+ *  parts, and rank r owns parts r*T, ..., r*T+T-1.  Cutting it into ranks
+ *  parts and later into (ranks x threads) parts would move cells between
+ *  ranks after their arrays are allocated, since recursive bisection cuts
+ *  differently unless the number of ranks is a power of two.
+ */
+void
+SolverMOC::_partitionMesh()
+{
+  bool spatial = Parallel::size() > 1 && !_angularDecomposition;
+  int numThreads = 1;
+#ifdef _OPENMP
+  numThreads = omp_get_max_threads();
+#endif
+
+  if (_threadSubdomains && numThreads > 1 && _subdomainPartition.size() == 0) {
+    int numRanks = spatial ? Parallel::size() : 1;
+    mesh->partitionMesh(numRanks*numThreads, _refinePartition);
+    _subdomainPartition = mesh->elementPartition;
+    if (spatial) {
+      for (long i=0; i<_prob.numCells; i++)
+        mesh->elementPartition[i] = _subdomainPartition[i]/numThreads;
+    }
+    else {
+      mesh->elementPartition.clear();
+    }
+  }
+  else if (spatial && mesh->elementPartition.size() == 0) {
+    mesh->partitionMesh(Parallel::size(), _refinePartition);
+  }
+}
+
+/// Choose the cells and edges whose angular fluxes this rank keeps
+/**
+ *  A rank of a spatial decomposition only sweeps its own cells, which read
+ *  and write the edges of these cells.  Ranks other than the root keep just
+ *  those, in mesh order; the root keeps all cells and edges to hold the
+ *  gathered solution.  The mesh is already partitioned, so the cells a rank
+ *  owns do not change once the arrays are allocated.
+ */
+void
+SolverMOC::_buildLocalStorage()
+{
+  if (Parallel::size() == 1 || _angularDecomposition || Parallel::isRoot())
+    return;
+
+  std::vector<char> keepEdge(_prob.numEdges, 0);
+  _localCell.assign(_prob.numCells, -1);
+  _numLocalCells = 0;
+  UltraLightElement element;
+  for (long i=0; i<_prob.numCells; i++) {
+    if (!_ownsCell(i)) continue;
+    _localCell[i] = _numLocalCells++;
+    mesh->getCurrentElementFromID(i, element);
+    for (int v=0; v<3; v++) {
+      long edge = mesh->getEdgeID(i, element.neighborID[v]);
+      if (edge >= 0)
+        keepEdge[edge] = 1;
+    }
+  }
+
+  _localEdge.assign(_prob.numEdges, -1);
+  _numLocalEdges = 0;
+  for (long e=0; e<_prob.numEdges; e++)
+    if (keepEdge[e])
+      _localEdge[e] = _numLocalEdges++;
+
+  LOG_DBG("Rank ", Parallel::rank(), " keeps the angular fluxes of ", _numLocalCells, " of ", _prob.numCells,
+          " cells and ", _numLocalEdges, " of ", _prob.numEdges, " edges.");
+}
+
+/// Allocate an edge or cell angular flux array
+/**
+ *  Out of core, the array is a shared mapping of a scratch file, so the
+ *  kernel pages it to disk and only recently swept directions stay
+ *  resident.  The file is unlinked right away and disappears with the
+ *  mapping.  If the file cannot be created or mapped, the array is kept in
+ *  memory.
+ *
+ *  The arrays keep the (edge, direction, group) layout, so a page only holds
+ *  part of the directions of an edge if 2*G*Q doubles exceed a page.  Out of
+ *  core only pays off for many groups (or directions); otherwise every block
+ *  of directions touches every page.
+ */
+double*
+SolverMOC::_allocateAngularArray(long size)
+{
+  if (_outOfCoreDirectory.empty())
+    return new double [size];
+
+  std::stringstream fileName;
+  fileName << _outOfCoreDirectory << "/radtrans_" << getpid() << "_" << _mappedArrays.size() << ".bin";
+  int file = open(fileName.str().c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (file < 0 || ftruncate(file, size*sizeof(double)) != 0) {
+    LOG_ERR("Could not create the out of core file ", fileName.str(), "; keeping the array in memory.");
+    if (file >= 0) {
+      close(file);
+      unlink(fileName.str().c_str());
+    }
+    return new double [size];
+  }
+  void* data = mmap(NULL, size*sizeof(double), PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+  close(file);
+  unlink(fileName.str().c_str());
+  if (data == MAP_FAILED) {
+    LOG_ERR("Could not map the out of core file ", fileName.str(), "; keeping the array in memory.");
+    return new double [size];
+  }
+
+  _mappedArrays[(double*)data] = size;
+  return (double*)data;
+}
+
+void
+SolverMOC::_freeAngularArray(double* data)
+{
+  std::map<double*, long>::iterator it = _mappedArrays.find(data);
+  if (it == _mappedArrays.end()) {
+    delete [] data;
+    return;
+  }
+  munmap(data, it->second*sizeof(double));
+  _mappedArrays.erase(it);
+}
+
+/// Start reading the pages of directions firstDirection, ..., lastDirection-1
+/**
+ *  The directions of one edge (or cell) are contiguous, so a block of
+ *  directions is one range per edge and cell.  The kernel is asked to read
+ *  these ranges ahead (without touching the values, which are being swept).
+ */
+void
+SolverMOC::_prefetchDirections(int firstDirection, int lastDirection)
+{
+  long pageSize = sysconf(_SC_PAGESIZE);
+  long edgeBlock = 2*_numStoredGroups;
+  long cellBlock = _numPhaseSpaceDOF/(_numLocalCells*_prob.quadOrder);
+
+  // Sweep front slots are not ordered by direction (and are small)
+  std::vector<double*> arrays;
+  if (!_sweepFrontStorage) {
+    arrays.push_back(_solution);
+    arrays.insert(arrays.end(), _interfaceArrays.begin(), _interfaceArrays.end());
+  }
+  int numEdgeArrays = arrays.size();
+  arrays.push_back(_source);
+  arrays.push_back(_cellFlux);
+
+  for (int a=0; a<arrays.size(); a++) {
+    bool edgeArray = (a < numEdgeArrays);
+    long block = edgeArray ? edgeBlock : cellBlock;
+    long numEntities = edgeArray ? _prob.numEdges : _prob.numCells;
+    for (long e=0; e<numEntities; e++) {
+      if (edgeArray ? !_storesEdge(e) : !_ownsCell(e)) continue;
+      long index = edgeArray ? _edgeIndex(e) : _cellIndex(e);
+      char* begin = (char*)(arrays[a] + (index*_prob.quadOrder + firstDirection)*block);
+      char* end = (char*)(arrays[a] + (index*_prob.quadOrder + lastDirection)*block);
+      char* page = begin - ((unsigned long)begin % pageSize);
+      madvise(page, end - page, MADV_WILLNEED);
+    }
+  }
+}
+
+/// Sweep order of direction n in batches of elements that are solved together
+/**
+ *  An element only depends on elements of earlier batches.  The common
+ *  traversal solves one element at a time.
+ */
+void
+SolverMOC::_sweepOrder(int n, std::vector<long>& order, std::vector<long>& batchStart)
+{
+  order.clear();
+  batchStart.clear();
+  long elementID;
+  Sweeper sweep(mesh, n + _prob.sweepOrderOffset);
+  while ((elementID = sweep.getNextElementID()) >= 0) {
+    if (!_ownsCell(elementID)) continue;
+    batchStart.push_back(order.size());
+    order.push_back(elementID);
+  }
+  batchStart.push_back(order.size());
+}
+
+/// Assign the edges of each direction to recycled sweep front slots
+/**
+ *  The flux of direction n on an interior edge is written by the element
+ *  swept first and read by the other one, so the edge needs a slot from the
+ *  first element's batch to the end of the second element's batch.  Slots are
+ *  only freed at the end of a batch, since the elements of a batch may be
+ *  solved in any order (and group by group).  Each direction has its own
+ *  slots, as directions are swept concurrently; group blocks of a direction
+ *  share them.  Boundary edges have a fixed slot per direction.
+ *
+ *  Edge fluxes lagged between sweeps (MPI interfaces, subdomain interfaces
+ *  and the angular convergence norm) are not kept, so a single rank with
+ *  direction threading and the scalar flux norm is required.
+ */
+void
+SolverMOC::_buildSweepFront()
+{
+  if (Parallel::size() > 1 || _threadSubdomains) {
+    LOG_ERR("Sweep front storage needs a single MPI rank and direction threading; storing all edges.");
+    _sweepFrontStorage = false;
+    return;
+  }
+  if (_angularConvergence) {
+    LOG_WARN("Sweep front storage tests inner convergence on the scalar flux.");
+    _angularConvergence = false;
+  }
+
+  PerfStats X("SolverMOC::_buildSweepFront");
+  int Q = _prob.quadOrder;
+
+  std::vector<int> boundarySlot(_prob.numEdges, -1);
+  int numBoundaryEdges = 0;
+  UltraLightElement element;
+  for (long i=0; i<_prob.numCells; i++) {
+    mesh->getCurrentElementFromID(i, element);
+    for (int v=0; v<3; v++) {
+      if (element.neighborID[v] >= 0) continue;
+      long edge = mesh->getEdgeID(i, element.neighborID[v]);
+      if (edge >= 0 && boundarySlot[edge] < 0)
+        boundarySlot[edge] = numBoundaryEdges++;
+    }
+  }
+
+  _edgeSlot.assign(_prob.numEdges*Q, -1);
+  std::vector<int> numFrontSlots(Q, 0);
+  #pragma omp parallel for schedule(dynamic)
+  for (int n=0; n<Q; n++) {
+    std::vector<long> order, batchStart;
+    _sweepOrder(n, order, batchStart);
+    std::vector<long> batch(_prob.numCells, -1);
+    for (long b=0; b+1<batchStart.size(); b++)
+      for (long k=batchStart[b]; k<batchStart[b+1]; k++)
+        batch[order[k]] = b;
+
+    std::vector<int> freeSlots, released;
+    int numSlots = 0;
+    UltraLightElement element;
+    for (long b=0; b+1<batchStart.size(); b++) {
+      released.clear();
+      for (long k=batchStart[b]; k<batchStart[b+1]; k++) {
+        long i = order[k];
+        mesh->getCurrentElementFromID(i, element);
+        for (int v=0; v<3; v++) {
+          long j = element.neighborID[v];
+          long edge = (j >= 0) ? mesh->getEdgeID(i, j) : -1;
+          if (edge < 0) continue;
+          int& slot = _edgeSlot[edge*Q + n];
+          if (slot < 0) {
+            if (freeSlots.size() > 0) {
+              slot = freeSlots.back();
+              freeSlots.pop_back();
+            }
+            else {
+              slot = numSlots++;
+            }
+            // Edges to elements of this batch (or that are not swept) end here
+            if (batch[j] <= b)
+              released.push_back(slot);
+          }
+          else if (batch[j] < b) {
+            released.push_back(slot);
+          }
+        }
+      }
+      freeSlots.insert(freeSlots.end(), released.begin(), released.end());
+    }
+    numFrontSlots[n] = numSlots;
+  }
+
+  // Boundary slots come first, then the front slots of each direction
+  std::vector<int> frontStart(Q+1, numBoundaryEdges*Q);
+  for (int n=0; n<Q; n++)
+    frontStart[n+1] = frontStart[n] + numFrontSlots[n];
+  _numEdgeSlots = frontStart[Q];
+
+  #pragma omp parallel for
+  for (long e=0; e<_prob.numEdges; e++) {
+    for (int n=0; n<Q; n++) {
+      if (boundarySlot[e] >= 0)
+        _edgeSlot[e*Q + n] = boundarySlot[e]*Q + n;
+      else if (_edgeSlot[e*Q + n] >= 0)
+        _edgeSlot[e*Q + n] += frontStart[n];
+    }
+  }
+
+  LOG("Sweep front storage: ", _numEdgeSlots, " edge slots instead of ", _prob.numEdges*Q,
+      " (", numBoundaryEdges*Q, " on the boundary).");
+}
+
+/// Check the settings and set up the scalar flux of group block storage
+/**
+ *  Between blocks only the scalar flux of each group is kept, so the scatter
+ *  source must be isotropic and inner convergence is tested on the scalar
+ *  flux.  Blocks are solved one after another over the whole mesh, which is
+ *  not combined with MPI decompositions.  Unsupported settings keep all
+ *  groups.
+ */
+void
+SolverMOC::_initializeGroupBlockStorage()
+{
+  if (Parallel::size() > 1 || _prob.scatterAnisotropy > 0) {
+    LOG_ERR("Group block storage needs a single MPI rank and isotropic scattering; storing all groups.");
+    _numStoredGroups = _prob.numGroups;
+    return;
+  }
+  if (_angularConvergence) {
+    LOG_WARN("Group block storage tests inner convergence on the scalar flux.");
+    _angularConvergence = false;
+  }
+
+  // Matches the initial cell fluxes of the in-memory solve
+  long size = _prob.numCells*_prob.numGroups*_numSubCells;
+  if (!_reducedScalarFlux)
+    _reducedScalarFlux = new double [size];
+  for (long i=0; i<size; i++)
+    _reducedScalarFlux[i] = 1.0;
+  _reducedScalarFluxValid = true;
+
+  LOG("Keeping the angular fluxes of ", _numStoredGroups, " of ", _prob.numGroups, " groups at a time.");
+}
+
+/// Make the angular arrays hold the group block starting at firstGroup
+/**
+ *  Edge fluxes of the previous block mean nothing for this one, so they
+ *  restart from zero, and the boundary plan is rebuilt for the new groups.
+ *  Only the groups of the block are swept.
+ */
+void
+SolverMOC::_setStoredGroupBlock(int firstGroup)
+{
+  _firstStoredGroup = firstGroup;
+  _bcPlan.clear();
+  _bdryFlux.clear();
+
+  #pragma omp parallel for
+  for (long i=0; i<_numDOF; i++)
+    _solution[i] = 0.0;
+
+  for (int g=0; g<_prob.numGroups; g++)
+    _groupActive[g] = _storesGroup(g);
+  _calculateCachedScalarFlux(true);
+}
+
+/// Update the scalar flux of the swept groups of the current block
+void
+SolverMOC::_storeBlockScalarFlux()
+{
+  int G = _prob.numGroups;
+  double sumOfWeights = 0.0;
+  for (int n=0; n<_prob.quadOrder; n++)
+    sumOfWeights += _prob.weights[n];
+
+  #pragma omp parallel for
+  for (long i=0; i<_prob.numCells; i++) {
+    for (int g=_firstStoredGroup; g<_endStoredGroup(); g++) {
+      if (!_groupActive[g]) continue;
+      for (int subCell=0; subCell<_numSubCells; subCell++) {
+        double scalarFlux = 0.0;
+        for (int n=0; n<_prob.quadOrder; n++)
+          scalarFlux += _prob.weights[n]*_cellFlux[_cellFluxIndex(i,n,g,subCell)];
+        _reducedScalarFlux[(i*G + g)*_numSubCells + subCell] = scalarFlux/sumOfWeights;
+      }
+    }
+  }
+}
+
+/// Scattering iterations with the angular fluxes of one group block at a time
+/**
+ *  Blocks are solved from fast to thermal groups (Gauss-Seidel in energy).
+ *  The inner iterations of a block converge its groups with the scatter
+ *  source of the latest scalar flux of all groups.  Without scattering from a
+ *  later block into an earlier one (or a Wielandt-shifted fission source) a
+ *  single pass is exact; otherwise passes are repeated until no block changes
+ *  by more than the inner tolerance in its first iteration.
+ *
+ *  Returns the largest change of the last iteration of any block in the last
+ *  pass.  scatterIter is the total number of iterations.
+ */
+double
+SolverMOC::_groupBlockIterations(int& scatterIter)
+{
+  int G = _prob.numGroups;
+  int B = _numStoredGroups;
+  bool upscatter = sourceConfig.hasFissionSource && _lambdaShift != 0.0;
+  for (int gp=0; gp<G; gp++)
+    for (int g=0; g<G; g++)
+      if (_groupCoupling[gp*G + g] && gp/B > g/B)
+        upscatter = true;
+
+  double maxDiff = 0.0;
+  scatterIter = 0;
+  for (int pass=0; pass<_maxIters; pass++) {
+    double passDiff = 0.0;
+    maxDiff = 0.0;
+    for (int firstGroup=0; firstGroup<G; firstGroup+=B) {
+      _setStoredGroupBlock(firstGroup);
+      for (int iter=0; iter<_maxIters; iter++) {
+        _saveOldFlux();
+        _calculateSource();
+        _sweepAllDirections();
+        _storeBlockScalarFlux();
+        scatterIter++;
+        double diff = _updateGroupConvergence();
+        if (iter == 0)
+          passDiff = std::max(passDiff, diff);
+        if (diff < _innerTol || iter == _maxIters-1) {
+          maxDiff = std::max(maxDiff, diff);
+          break;
+        }
+      }
+    }
+    if (!upscatter || passDiff < _innerTol) break;
+    LOG_DBG("Group block pass ", pass+1, ": change ", passDiff);
+  }
+  return maxDiff;
+}
+
+/// Sweep the numSources external sources of the problem together
+/**
+ *  Each source gets its own edge, cell and scalar flux arrays, starting from
+ *  zero.  Batching needs a problem without fission (the sources are
+ *  independent), every angular flux in memory on a single rank swept without
+ *  subdomains (the sweep writes the edge fluxes of every source directly),
+ *  and no reflecting boundaries (reflected boundary fluxes are shared by all
+ *  sources).  Returns false, and keeps the solver unchanged, otherwise.
+ *  Call after setupDecomposition.
+ */
+bool
+SolverMOC::setBatchedSources(int numSources)
+{
+  if (_batchedArrays.size() > 0 || numSources <= 1)
+    return numSources == _numBatchedSources;
+
+  bool fission = eigenvalueMode;
+  for (std::map<unsigned int, Material*>::iterator it=MaterialFactory::_materialID.begin();
+       it!=MaterialFactory::_materialID.end();
+       ++it) {
+    for (int g=0; g<_prob.numGroups; g++)
+      if (*it->second->getNuSigma_f(g+1) != 0.0)
+        fission = true;
+  }
+
+  std::string reason;
+  if (fission)
+    reason = "the problem has fission";
+  else if (Parallel::size() > 1)
+    reason = "the sweeps are decomposed across ranks";
+  else if (_numSubdomains > 1)
+    reason = "the threads sweep subdomains";
+  else if (_groupBlockStorage() || _sweepFrontStorage || _mappedArrays.size() > 0)
+    reason = "not all angular fluxes are kept in memory";
+  else if (_prob.globalBC == reflecting)
+    reason = "reflected boundary fluxes are not kept per source";
+  if (!reason.empty()) {
+    LOG("Solving the ", numSources, " external sources one after another, since ", reason, ".");
+    return false;
+  }
+
+  _batchedArrays.resize(numSources);
+  for (int s=1; s<numSources; s++) {
+    BatchedSourceArrays& arrays = _batchedArrays[s];
+    arrays.solution = _allocateAngularArray(_numDOF);
+    arrays.solutionPrev = _allocateAngularArray(_numDOF);
+    arrays.source = _allocateAngularArray(_numPhaseSpaceDOF);
+    arrays.cellFlux = _allocateAngularArray(_numPhaseSpaceDOF);
+    arrays.solutionStorage = arrays.scalarFlux = arrays.scalarFluxPrev = NULL;
+    arrays.reflectFromPrev = false;
+  }
+  _numBatchedSources = numSources;
+
+  // First touch in the static blocks of _placeStorage
+  long cellBlock = _numPhaseSpaceDOF/_numLocalCells;
+  long edgeBlock = _numDOF/_numLocalEdges;
+  #pragma omp parallel for schedule(static)
+  for (long i=0; i<_prob.numCells; i++)
+    for (int s=1; s<numSources; s++)
+      for (long b=0; b<cellBlock; b++) {
+        _batchedArrays[s].source[i*cellBlock + b] = 0.0;
+        _batchedArrays[s].cellFlux[i*cellBlock + b] = 0.0;
+      }
+  #pragma omp parallel for schedule(static)
+  for (long e=0; e<_prob.numEdges; e++)
+    for (int s=1; s<numSources; s++)
+      for (long b=0; b<edgeBlock; b++) {
+        _batchedArrays[s].solution[e*edgeBlock + b] = 0.0;
+        _batchedArrays[s].solutionPrev[e*edgeBlock + b] = 0.0;
+      }
+
+  LOG("Sweeping ", numSources, " external sources together.");
+  return true;
+}
+
+/// Make the fluxes of batched source s the solver's fluxes (e.g., for output)
+void
+SolverMOC::selectBatchedSource(int source)
+{
+  if (source >= 0 && source < _numBatchedSources)
+    _activateSource(source);
+}
+
+/// Swap the arrays of batched source s in as the solver's arrays
+void
+SolverMOC::_activateSource(int s)
+{
+  if (s == _activeSource)
+    return;
+
+  BatchedSourceArrays& active = _batchedArrays[_activeSource];
+  active.solution = _solution;
+  active.solutionPrev = _solutionPrev;
+  active.solutionStorage = _solutionStorage;
+  active.source = _source;
+  active.cellFlux = _cellFlux;
+  active.scalarFlux = _scalarFlux;
+  active.scalarFluxPrev = _scalarFluxPrev;
+  active.reflectFromPrev = _reflectFromPrev;
+
+  const BatchedSourceArrays& next = _batchedArrays[s];
+  _solution = next.solution;
+  _solutionPrev = next.solutionPrev;
+  _solutionStorage = next.solutionStorage;
+  _source = next.source;
+  _cellFlux = next.cellFlux;
+  _scalarFlux = next.scalarFlux;
+  _scalarFluxPrev = next.scalarFluxPrev;
+  _reflectFromPrev = next.reflectFromPrev;
+  _activeSource = s;
+}
+
+/// Scattering iterations of all batched sources
+/**
+ *  Each iteration forms the source of every batched external source in turn
+ *  and then sweeps once with source 0 active; the element kernels solve all
+ *  sources after finding the element orientation.  Convergence is tested per
+ *  source, and a group is only frozen once it has converged for every source.
+ *
+ *  Returns the largest change over the sources in the last iteration.
+ */
+double
+SolverMOC::_batchedSourceIterations(int& scatterIter)
+{
+  int G = _prob.numGroups;
+  for (int s=0; s<_numBatchedSources; s++) {
+    _activateSource(s);
+    _initializeGroupConvergence();
+  }
+
+  double maxDiff = 0.0;
+  for (scatterIter=0; scatterIter<_maxIters; scatterIter++) {
+    for (int s=0; s<_numBatchedSources; s++) {
+      _activateSource(s);
+      _prob.selectSource(s);
+      _saveOldFlux();
+      _calculateSource();
+    }
+    _activateSource(0);
+    _sweepAllDirections();
+
+    std::vector<bool> swept = _groupActive;
+    std::vector<bool> active(G, false);
+    maxDiff = 0.0;
+    for (int s=0; s<_numBatchedSources; s++) {
+      _activateSource(s);
+      _groupActive = swept;
+      maxDiff = std::max(maxDiff, _updateGroupConvergence());
+      for (int g=0; g<G; g++)
+        active[g] = active[g] || _groupActive[g];
+    }
+    _groupActive = active;
+    if (maxDiff < _innerTol) break;
+  }
+
+  for (int s=_numBatchedSources-1; s>=0; s--) {
+    _activateSource(s);
+    _restoreSolutionStorage();
+  }
+  return maxDiff;
+}
+
+/// First touch initialization of the edge and cell arrays
+/**
+ *  With subdomain threading the cells of a subdomain, and the edges of those
+ *  cells, are written by the thread that sweeps the subdomain.  Otherwise
+ *  (and for the cells of other ranks kept by the root) cells and edges are
+ *  written in static blocks, matching the static loops over cells of the
+ *  source and flux calculations.  Directions and groups are innermost in the
+ *  arrays, so threading over them cannot be matched by placement.
+ */
+void
+SolverMOC::_placeStorage()
+{
+  PerfStats X("SolverMOC::_placeStorage");
+  long cellBlock = _numPhaseSpaceDOF/_numLocalCells;
+  long edgeBlock = _sweepFrontStorage ? 0 : _numDOF/_numLocalEdges;
+  std::vector<double*> edgeArrays;
+  edgeArrays.push_back(_solution);
+  edgeArrays.push_back(_solutionPrev);
+  edgeArrays.push_back(_residual);
+  edgeArrays.insert(edgeArrays.end(), _interfaceArrays.begin(), _interfaceArrays.end());
+
+  std::vector<char> cellPlaced(_prob.numCells, 0), edgePlaced(_prob.numEdges, 0);
+  std::vector< std::vector<long> > subdomainEdges(_numSubdomains);
+  if (_numSubdomains > 1) {
+    UltraLightElement element;
+    for (int s=0; s<_numSubdomains; s++) {
+      const std::vector<long>& cells = _subdomainOrder[s][0];
+      for (long k=0; k<cells.size(); k++) {
+        cellPlaced[cells[k]] = 1;
+        mesh->getCurrentElementFromID(cells[k], element);
+        for (int v=0; v<3; v++) {
+          long edge = mesh->getEdgeID(cells[k], element.neighborID[v]);
+          if (edge < 0 || edgePlaced[edge]) continue;
+          edgePlaced[edge] = 1;
+          subdomainEdges[s].push_back(edge);
+        }
+      }
+    }
+
+    #pragma omp parallel for schedule(static,1)
+    for (int s=0; s<_numSubdomains; s++) {
+      const std::vector<long>& cells = _subdomainOrder[s][0];
+      for (long k=0; k<cells.size(); k++) {
+        long cell = _cellIndex(cells[k]);
+        for (long b=0; b<cellBlock; b++) {
+          _source[cell*cellBlock + b] = 0.0;
+          _cellFlux[cell*cellBlock + b] = 1.0;
+        }
+      }
+      for (long k=0; k<subdomainEdges[s].size(); k++)
+        for (int a=0; a<edgeArrays.size(); a++)
+          for (long b=0; b<edgeBlock; b++)
+            edgeArrays[a][_edgeIndex(subdomainEdges[s][k])*edgeBlock + b] = 0.0;
+    }
+  }
+
+  #pragma omp parallel for schedule(static)
+  for (long i=0; i<_prob.numCells; i++) {
+    if (cellPlaced[i] || !_storesCell(i)) continue;
+    long cell = _cellIndex(i);
+    for (long b=0; b<cellBlock; b++) {
+      _source[cell*cellBlock + b] = 0.0;
+      _cellFlux[cell*cellBlock + b] = 1.0;
+    }
+  }
+  #pragma omp parallel for schedule(static)
+  for (long e=0; e<_prob.numEdges; e++) {
+    if (edgePlaced[e] || !_storesEdge(e)) continue;
+    long edge = _edgeIndex(e);
+    for (int a=0; a<edgeArrays.size(); a++)
+      for (long b=0; b<edgeBlock; b++)
+        edgeArrays[a][edge*edgeBlock + b] = 0.0;
+  }
+  // Sweep front slots are not tied to edges
+  if (_sweepFrontStorage) {
+    #pragma omp parallel for schedule(static)
+    for (long i=0; i<_numDOF; i++)
+      for (int a=0; a<edgeArrays.size(); a++)
+        edgeArrays[a][i] = 0.0;
+  }
+
+  if (_numSubdomains > 1)
+    LOG("Solver arrays first touched by the threads of their subdomains.");
+  else
+    LOG("Solver arrays first touched in static blocks of cells and edges.");
+}
+
+/// Choose the thread decomposition of the sweeps
+/**
+ *  The cost model estimates the parallel efficiency of each strategy from
+ *  the number of threads, owned directions, groups and cells (the largest
+ *  thread and direction counts and the smallest cell count of any rank, so
+ *  all ranks choose alike):
+ *  - angle: one task per direction;
+ *  - angle x group: directions split into group blocks (only differs from
+ *    the angle strategy with fewer directions than threads);
+ *  - subdomain: one spatial subdomain per thread (only with enough cells per
+ *    thread, and not combined with an MPI spatial decomposition, whose
+ *    partition is fixed by now, or with sweep front storage).
+ *  Strategies that can be efficient are timed over a few sweeps and the
+ *  fastest is kept.  Subdomain sweeps lag the interface fluxes, which costs
+ *  extra iterations, so they must be clearly faster per sweep.  The choice
+ *  is cached by machine and problem signature in sweep_strategy.cache.
+ */
+void
+SolverMOC::_selectSweepStrategy()
+{
+  const char* strategyName[numSweepStrategies] = {"angle", "angle x group", "subdomain"};
+  const long minCellsPerSubdomain = 256;
+  const double subdomainMargin = 0.9;
+  const int numTrialSweeps = 2;
+
+  int numThreads = 1;
+#ifdef _OPENMP
+  numThreads = omp_get_max_threads();
+#endif
+  int G = _prob.numGroups;
+  int numDirections = 0;
+  for (int n=0; n<_prob.quadOrder; n++)
+    if (_ownsDirection(n))
+      numDirections++;
+  long numCells = 0;
+  for (long i=0; i<_prob.numCells; i++)
+    if (_ownsCell(i))
+      numCells++;
+  double cellSweeps = Parallel::sumAll((double)numCells*numDirections*G);
+
+  // Trial sweeps are collective, so every rank must take the same branches:
+  // the model uses the most threads and directions and the fewest cells of
+  // any rank
+  numThreads = (int)Parallel::maxAll(numThreads);
+  numDirections = (int)Parallel::maxAll(numDirections);
+  numCells = (long)-Parallel::maxAll(-(double)numCells);
+  if (numDirections == 0) {
+    LOG("Using ", strategyName[angleSweeps], " sweeps.");
+    _setSweepStrategy(angleSweeps);
+    return;
+  }
+
+  // Cost model
+  std::vector<bool> candidate(numSweepStrategies, false);
+  std::vector<double> efficiency(numSweepStrategies, 0.0);
+  int numTasks = numDirections;
+  efficiency[angleSweeps] = numTasks/(double)(numThreads*((numTasks + numThreads - 1)/numThreads));
+  candidate[angleSweeps] = true;
+  if (numDirections < numThreads && G > 1) {
+    numTasks = numDirections*std::min(G, (2*numThreads + numDirections - 1)/numDirections);
+    efficiency[angleGroupSweeps] = numTasks/(double)(numThreads*((numTasks + numThreads - 1)/numThreads));
+    candidate[angleGroupSweeps] = true;
+  }
+  if ((Parallel::size() == 1 || _angularDecomposition) && !_sweepFrontStorage &&
+      numCells >= minCellsPerSubdomain*numThreads) {
+    efficiency[subdomainSweeps] = 1.0;
+    candidate[subdomainSweeps] = true;
+  }
+  for (int s=0; s<numSweepStrategies; s++) {
+    if (candidate[s])
+      LOG("Cost model: ", strategyName[s], " sweeps have a parallel efficiency of ", efficiency[s], " on ", numThreads, " threads.");
+    // Strategies far below the best bound are not worth a trial
+    if (efficiency[s] < 0.5*efficiency[angleSweeps])
+      candidate[s] = false;
+  }
+
+  int numCandidates = 0;
+  for (int s=0; s<numSweepStrategies; s++)
+    numCandidates += candidate[s];
+  if (numThreads == 1 || numCandidates == 1) {
+    LOG("Using ", strategyName[angleSweeps], " sweeps.");
+    _setSweepStrategy(angleSweeps);
+    return;
+  }
+
+  // A cached decision skips the trials
+  std::string signature = _sweepStrategySignature();
+  double cached = -1.0;
+  if (Parallel::isRoot()) {
+    std::ifstream cacheFile("sweep_strategy.cache");
+    std::string line;
+    while (std::getline(cacheFile, line)) {
+      size_t split = line.rfind(' ');
+      if (split != std::string::npos && line.substr(0, split) == signature)
+        cached = std::atoi(line.substr(split+1).c_str());
+    }
+  }
+  cached = Parallel::maxAll(cached);
+  if (cached >= 0 && cached < numSweepStrategies && candidate[(int)cached]) {
+    LOG("Using ", strategyName[(int)cached], " sweeps (cached for this machine and problem).");
+    _setSweepStrategy(SweepStrategy(cached));
+    return;
+  }
+
+  // Timed trials, with boundary fluxes set so sweeps only read existing entries
+  _groupActive.assign(G, true);
+  _applyBoundaryConditions();
+  SweepStrategy best = angleSweeps;
+  double bestTime = 0.0;
+  for (int s=0; s<numSweepStrategies; s++) {
+    if (!candidate[s]) continue;
+    _setSweepStrategy(SweepStrategy(s));
+    _timeSweeps(1);  // warm up (and tune group blocks)
+    double sweepTime = _timeSweeps(numTrialSweeps);
+    LOG("Trial: ", strategyName[s], " sweeps at ", cellSweeps/sweepTime, " cell-direction-groups per second.");
+    if (s == subdomainSweeps)
+      sweepTime /= subdomainMargin;
+    if (s == angleSweeps || sweepTime < bestTime) {
+      best = SweepStrategy(s);
+      bestTime = sweepTime;
+    }
+  }
+  _setSweepStrategy(best);
+  LOG("Using ", strategyName[best], " sweeps.");
+
+  if (Parallel::isRoot()) {
+    std::ofstream cacheFile("sweep_strategy.cache", std::ios::app);
+    cacheFile << signature << " " << best << std::endl;
+  }
+}
+
+/// Switch the sweeps to a thread decomposition
+void
+SolverMOC::_setSweepStrategy(SweepStrategy strategy)
+{
+  _threadSubdomains = (strategy == subdomainSweeps);
+  if (_threadSubdomains) {
+    if (_subdomainOrder.size() == 0)
+      _buildSubdomains();
+    else
+      _numSubdomains = _subdomainOrder.size();
+  }
+  else {
+    _numSubdomains = 1;
+  }
+
+  if (strategy == angleSweeps) {
+    _groupBlockSize = _numStoredGroups;
+    _groupBlockSizeTuned = true;
+  }
+  else if (strategy == angleGroupSweeps && _groupBlockSize == _numStoredGroups) {
+    _groupBlockSize = 0;
+    _groupBlockSizeTuned = false;
+  }
+}
+
+/// Mean wall time of numSweeps transport sweeps (the slowest rank's)
+double
+SolverMOC::_timeSweeps(int numSweeps)
+{
+  double start = Timing::get_wall_time();
+  for (int k=0; k<numSweeps; k++) {
+    if (_numSubdomains > 1)
+      _sweepSubdomains();
+    else
+      _sweepAngleGroupBlocks();
+  }
+  return Parallel::maxAll(Timing::get_wall_time() - start)/numSweeps;
+}
+
+/// Machine and problem dimensions the sweep strategy choice depends on
+std::string
+SolverMOC::_sweepStrategySignature()
+{
+  char hostName[256] = "unknown";
+  gethostname(hostName, sizeof(hostName));
+  hostName[sizeof(hostName)-1] = 0;
+  int numThreads = 1;
+#ifdef _OPENMP
+  numThreads = omp_get_max_threads();
+#endif
+
+  std::stringstream signature;
+  signature << hostName << " ranks=" << Parallel::size()
+            << (_angularDecomposition ? " angular" : " spatial")
+            << " threads=" << numThreads << " subcells=" << _numSubCells
+            << " cells=" << _prob.numCells << " edges=" << _prob.numEdges
+            << " directions=" << _prob.quadOrder << " groups=" << _prob.numGroups
+            << " cache=" << _cacheSweepGeometry;
+  return signature.str();
+}
+
+/// Split the cells of this rank into one subdomain per thread
+/**
+ *  The mesh is partitioned into (ranks x threads) parts (see _partitionMesh);
+ *  consecutive parts of the recursive bisection are spatially close, so rank
+ *  r takes parts r*T, ..., r*T+T-1 and thread s sweeps the part r*T+s.  The
+ *  partition is only made here when the sweep strategy trials switch to
+ *  subdomains, which they do without a spatial decomposition.  The sweep order
+ *  lists of a subdomain are built by the thread that sweeps it, so they are
+ *  allocated in its memory.
+ */
+void
+SolverMOC::_buildSubdomains()
+{
+  int numThreads = 1;
+#ifdef _OPENMP
+  numThreads = omp_get_max_threads();
+#endif
+  if (numThreads == 1) {
+    LOG_WARN("Subdomain sweeps need more than one thread; sweeping directions in parallel instead.");
+    return;
+  }
+  if (_cacheSweepGeometry)
+    LOG_WARN("Cached sweep geometry is not used by subdomain sweeps.");
+
+  _partitionMesh();
+  const std::vector<int>& part = _subdomainPartition;
+  _numSubdomains = numThreads;
+
+  // Edges between two subdomains of this rank are staged
+  _subdomainSlot.assign(_prob.numEdges, -1);
+  _subdomainSlotEdge.clear();
+  UltraLightElement element;
+  for (long i=0; i<_prob.numCells; i++) {
+    if (!_ownsCell(i)) continue;
+    mesh->getCurrentElementFromID(i, element);
+    for (int v=0; v<3; v++) {
+      long j = element.neighborID[v];
+      if (j < 0 || part[j] == part[i] || !_ownsCell(j)) continue;
+      long edge = mesh->getEdgeID(i, j);
+      if (_subdomainSlot[edge] >= 0) continue;
+      _subdomainSlot[edge] = _subdomainSlotEdge.size();
+      _subdomainSlotEdge.push_back(edge);
+    }
+  }
+  long stagedSize = _subdomainSlotEdge.size()*_prob.quadOrder*2*_numStoredGroups;
+  for (int a=0; a<_stagedEdgeFlux.size(); a++)
+    delete [] _stagedEdgeFlux[a];
+  _stagedEdgeFlux.assign(1 + _interfaceArrays.size(), NULL);
+  for (int a=0; a<_stagedEdgeFlux.size(); a++)
+    _stagedEdgeFlux[a] = new double [stagedSize];
+
+  _subdomainOrder.assign(_numSubdomains, std::vector< std::vector<long> >(_prob.quadOrder));
+  #pragma omp parallel for schedule(static,1)
+  for (int s=0; s<_numSubdomains; s++) {
+    for (int n=0; n<_prob.quadOrder; n++) {
+      long elementID;
+      Sweeper sweep(mesh, n + _prob.sweepOrderOffset);
+      while ((elementID = sweep.getNextElementID()) >= 0) {
+        if (part[elementID] % numThreads == s && _ownsCell(elementID))
+          _subdomainOrder[s][n].push_back(elementID);
+      }
+    }
+  }
+
+  LOG("Sweeping ", _numSubdomains, " subdomains in parallel with ",
+      _subdomainSlotEdge.size(), " lagged interface edges.");
+}
+
+/// Block Jacobi sweep of all subdomains
+/**
+ *  The staged interface DOFs start from the current solution, so entries no
+ *  element writes (inactive groups, directions parallel to the edge) keep
+ *  their values when copied back.
+ */
+void
+SolverMOC::_sweepSubdomains()
+{
+  PerfStats X("SolverMOC::_sweepSubdomains");
+  long block = _prob.quadOrder*2*_numStoredGroups;
+  std::vector<double*> arrays(1, _solution);
+  arrays.insert(arrays.end(), _interfaceArrays.begin(), _interfaceArrays.end());
+
+  #pragma omp parallel for
+  for (long slot=0; slot<_subdomainSlotEdge.size(); slot++) {
+    long edge = _edgeIndex(_subdomainSlotEdge[slot]);
+    for (int a=0; a<arrays.size(); a++)
+      for (long b=0; b<block; b++)
+        _stagedEdgeFlux[a][slot*block + b] = arrays[a][edge*block + b];
+  }
+
+  #pragma omp parallel for schedule(static,1)
+  for (int s=0; s<_numSubdomains; s++) {
+    UltraLightElement element;
+    for (int n=0; n<_prob.quadOrder; n++) {
+      if (!_ownsDirection(n)) continue;
+      const std::vector<long>& order = _subdomainOrder[s][n];
+      for (long k=0; k<order.size(); k++) {
+        mesh->getCurrentElementFromID(order[k], element);
+        _solveElement(element, order[k], n, _firstStoredGroup, _endStoredGroup());
+      }
+    }
+  }
+
+  #pragma omp parallel for
+  for (long slot=0; slot<_subdomainSlotEdge.size(); slot++) {
+    long edge = _edgeIndex(_subdomainSlotEdge[slot]);
+    for (int a=0; a<arrays.size(); a++)
+      for (long b=0; b<block; b++)
+        arrays[a][edge*block + b] = _stagedEdgeFlux[a][slot*block + b];
+  }
+}
+
+/// Set up the interface flux exchange of a spatial decomposition
+/**
+ *  An interface edge carries the flux of direction n from rank p to rank r if
+ *  the element on the p side is upwind.  Both ranks visit the interface edges
+ *  in the same order, so the send and receive lists match without any
+ *  communication.
+ */
+void
+SolverMOC::_buildInterfaceExchange()
+{
+  int rank = Parallel::rank();
+  std::vector<int>& partition = mesh->elementPartition;
+  int nxtNghbr[3] = {1, 2, 0};
+
+  std::map<int, int> neighborIndex;
+  _edgeOwner.assign(_prob.numEdges, -1);
+
+  UltraLightElement element;
+  for (long i=0; i<_prob.numCells; i++) {
+    int owner = partition[i];
+    mesh->getCurrentElementFromID(i, element);
+    double xc = (element.x[0] + element.x[1] + element.x[2])/3.0;
+    double yc = (element.y[0] + element.y[1] + element.y[2])/3.0;
+    for (int v=0; v<3; v++) {
+      long edge = mesh->getEdgeID(i, element.neighborID[v]);
+      if (edge >= 0 && _edgeOwner[edge] < 0)
+        _edgeOwner[edge] = owner;
+
+      long j = element.neighborID[v];
+      if (j < 0 || partition[j] == owner) continue;
+      if (owner != rank && partition[j] != rank) continue;
+      int other = (owner == rank) ? partition[j] : owner;
+      if (neighborIndex.count(other) == 0) {
+        neighborIndex[other] = _neighborRanks.size();
+        _neighborRanks.push_back(other);
+        _sendOffsets.resize(_neighborRanks.size());
+        _recvOffsets.resize(_neighborRanks.size());
+      }
+      int k = neighborIndex[other];
+
+      int vn = nxtNghbr[v];
+      double nx = element.y[vn] - element.y[v];
+      double ny = element.x[v] - element.x[vn];
+      // Make the normal point out of element i
+      if (nx*(0.5*(element.x[v]+element.x[vn]) - xc) + ny*(0.5*(element.y[v]+element.y[vn]) - yc) < 0.0) {
+        nx = -nx;
+        ny = -ny;
+      }
+      for (int n=0; n<_prob.quadOrder; n++) {
+        if (_prob.omega_x[n]*nx + _prob.omega_y[n]*ny <= 0.0) continue;
+        long offset = _edgeOffset(edge, n);
+        if (owner == rank)
+          _sendOffsets[k].push_back(offset);
+        else
+          _recvOffsets[k].push_back(offset);
+      }
+    }
+  }
+
+  LOG_DBG("Rank ", rank, " exchanges interface fluxes with ", _neighborRanks.size(), " ranks.");
+}
+
+/// Send the outgoing interface fluxes and receive the incoming ones
+void
+SolverMOC::_exchangeInterfaceFlux()
+{
+  if (_neighborRanks.size() == 0)
+    return;
+
+  PerfStats X("SolverMOC::_exchangeInterfaceFlux");
+  long blockSize = 2*_numStoredGroups;
+  std::vector<double*> arrays(1, _solution);
+  arrays.insert(arrays.end(), _interfaceArrays.begin(), _interfaceArrays.end());
+  long entrySize = blockSize*arrays.size();
+
+  std::vector< std::vector<double> > sendBuffers(_neighborRanks.size());
+  std::vector< std::vector<double> > recvBuffers(_neighborRanks.size());
+  for (int k=0; k<_neighborRanks.size(); k++) {
+    sendBuffers[k].resize(_sendOffsets[k].size()*entrySize);
+    recvBuffers[k].resize(_recvOffsets[k].size()*entrySize);
+    double* buffer = sendBuffers[k].data();
+    for (long e=0; e<_sendOffsets[k].size(); e++)
+      for (int a=0; a<arrays.size(); a++)
+        for (long b=0; b<blockSize; b++)
+          *buffer++ = arrays[a][_sendOffsets[k][e] + b];
+  }
+
+  Parallel::exchange(_neighborRanks, sendBuffers, recvBuffers);
+
+  for (int k=0; k<_neighborRanks.size(); k++) {
+    double* buffer = recvBuffers[k].data();
+    for (long e=0; e<_recvOffsets[k].size(); e++)
+      for (int a=0; a<arrays.size(); a++)
+        for (long b=0; b<blockSize; b++)
+          arrays[a][_recvOffsets[k][e] + b] = *buffer++;
+  }
+}
+
+/// Gather the solution on the root rank after a decomposed solve
+/**
+ *  Each rank sends the fluxes of its own cells and of the edges it provides,
+ *  those whose first adjacent element it owns (which, after the last
+ *  exchange, hold all of their directions), in mesh order, so the root can
+ *  place them without an index list.  The other ranks keep their own part of
+ *  the solution only.
+ */
+void
+SolverMOC::_gatherSolution()
+{
+  if (_angularDecomposition) {
+    _sumOwnedDirections(_cellFlux, _solution);
+    _reducedScalarFluxValid = false;
+    _reducedFluxMomentsValid = false;
+    return;
+  }
+  if (!_spatialDecomposition())
+    return;
+
+  PerfStats X("SolverMOC::_gatherSolution");
+  int rank = Parallel::rank();
+  std::vector<int>& partition = mesh->elementPartition;
+  long cellBlock = _numPhaseSpaceDOF/_numLocalCells;
+  long edgeBlock = _numDOF/_numLocalEdges;
+
+  std::vector<int> ranks;
+  std::vector< std::vector<double> > sendBuffers, recvBuffers;
+  if (!Parallel::isRoot()) {
+    ranks.push_back(0);
+    sendBuffers.resize(1);
+    recvBuffers.resize(1);
+    std::vector<double>& buffer = sendBuffers[0];
+    for (long i=0; i<_prob.numCells; i++) {
+      if (partition[i] != rank) continue;
+      const double* flux = _cellFlux + _cellIndex(i)*cellBlock;
+      buffer.insert(buffer.end(), flux, flux + cellBlock);
+    }
+    for (long e=0; e<_prob.numEdges; e++) {
+      if (_edgeOwner[e] != rank) continue;
+      const double* flux = _solution + _edgeIndex(e)*edgeBlock;
+      buffer.insert(buffer.end(), flux, flux + edgeBlock);
+    }
+  }
+  else {
+    std::vector<long> size(Parallel::size(), 0);
+    for (long i=0; i<_prob.numCells; i++)
+      size[partition[i]] += cellBlock;
+    for (long e=0; e<_prob.numEdges; e++)
+      size[_edgeOwner[e]] += edgeBlock;
+    for (int r=1; r<Parallel::size(); r++)
+      ranks.push_back(r);
+    sendBuffers.resize(ranks.size());
+    recvBuffers.resize(ranks.size());
+    for (int k=0; k<ranks.size(); k++)
+      recvBuffers[k].resize(size[ranks[k]]);
+  }
+
+  Parallel::exchange(ranks, sendBuffers, recvBuffers);
+  if (!Parallel::isRoot())
+    return;
+
+  std::vector<const double*> next(Parallel::size(), (const double*)NULL);
+  for (int k=0; k<ranks.size(); k++)
+    next[ranks[k]] = recvBuffers[k].data();
+  for (long i=0; i<_prob.numCells; i++) {
+    int r = partition[i];
+    if (r == rank) continue;
+    std::copy(next[r], next[r] + cellBlock, _cellFlux + i*cellBlock);
+    next[r] += cellBlock;
+  }
+  for (long e=0; e<_prob.numEdges; e++) {
+    int r = _edgeOwner[e];
+    if (r == rank) continue;
+    std::copy(next[r], next[r] + edgeBlock, _solution + e*edgeBlock);
+    next[r] += edgeBlock;
+  }
+}
+
+/// Number of edge DOFs of the whole mesh (the root's solution layout)
+long
+SolverMOC::getNumGlobalDOFs()
+{
+  if (_localEdge.empty())
+    return _numDOF;
+  return _numDOF/_numLocalEdges*_prob.numEdges;
+}
+
+/// Set the edge fluxes from a solution of the whole mesh
+/**
+ *  Ranks that only keep some edges take the blocks of those edges.
+ */
+void
+SolverMOC::setSolution(double* solution)
+{
+  if (_localEdge.empty()) {
+    SolverBase::setSolution(solution);
+    return;
+  }
+
+  long edgeBlock = _numDOF/_numLocalEdges;
+  for (long e=0; e<_prob.numEdges; e++)
+    if (_storesEdge(e))
+      std::copy(solution + e*edgeBlock, solution + (e+1)*edgeBlock, _solution + _edgeIndex(e)*edgeBlock);
+}
+
+/// Write the boundary edge angular fluxes
+/**
+ *  Edge fluxes (averaged over the two edge locations) are written for all
+ *  directions in the layout read by TransportProblem as a boundary source, so
+ *  the outgoing flux of this calculation can drive another one.  Edge DOFs are
+ *  ordered (edge, angle, group, edge location) in all MOC solvers.  Only the
+ *  root rank writes output and keeps every edge.
+ */
+void
+SolverMOC::writeBoundaryFlux(Output* outputFile, std::string suffix)
+{
+  if (!Parallel::isRoot())
+    return;
+
+  std::vector<int> edges;
+  UltraLightElement element;
+  for (long be=0; be < mesh->boundaryElements.size(); be++) {
+    long elementID = mesh->boundaryElements[be];
+    mesh->getCurrentElementFromID(elementID, element);
+    for (int v=0; v<3; v++)
+      if (element.neighborID[v] < 0)
+        edges.push_back( mesh->getEdgeID(elementID, element.neighborID[v]) );
+  }
+  if (edges.size() == 0)
+    return;
+
+  // With group block storage only the last block is known; the other groups
+  // are written as zero
+  long numValues = edges.size()*_prob.quadOrder*_prob.numGroups;
+  double* outputBuffer = new double [ numValues ];
+  for (long e=0; e<edges.size(); e++)
+    for (int n=0; n<_prob.quadOrder; n++)
+      for (int g=0; g<_prob.numGroups; g++) {
+        double& value = outputBuffer[ (e*_prob.quadOrder + n)*_prob.numGroups + g ];
+        if (!_storesGroup(g)) {
+          value = 0.0;
+          continue;
+        }
+        const double* edgeFlux = &_solution[ _edgeOffset(edges[e],n) + 2*(g - _firstStoredGroup) ];
+        value = 0.5*(edgeFlux[0] + edgeFlux[1]);
+      }
+
+  outputFile->writeData("boundaryEdges" + suffix, &edges[0], edges.size());
+  outputFile->writeData("boundaryFlux" + suffix, outputBuffer, numValues);
+  delete [] outputBuffer;
+}
+
+/// Combine the fluxes of the directions swept on each rank
+/**
+ *  Only the sub-cell scalar flux and, with anisotropic scattering, the flux
+ *  moments are summed over the ranks, not the cell angular fluxes.  Edge
+ *  fluxes only cross direction ownership at reflecting boundaries, so only the
+ *  boundary edges are summed.
+ */
+void
+SolverMOC::_reduceAngularFlux()
+{
+  if (!_angularDecomposition)
+    return;
+
+  PerfStats X("SolverMOC::_reduceAngularFlux");
+  if (_prob.globalBC == reflecting)
+    _sumBoundaryEdgeFlux();
+
+  int G = _prob.numGroups;
+  int Q = _prob.quadOrder;
+  long size = _prob.numCells*G*_numSubCells;
+  if (!_reducedScalarFlux)
+    _reducedScalarFlux = new double [size];
+
+  double sumOfWeights = 0.0;
+  for (int n=0; n<Q; n++)
+    sumOfWeights += _prob.weights[n];
+
+  #pragma omp parallel for
+  for (long i=0; i<_prob.numCells; i++) {
+    for (int g=0; g<G; g++) {
+      for (int subCell=0; subCell<_numSubCells; subCell++) {
+        double scalarFlux = 0.0;
+        for (int n=Parallel::rank(); n<Q; n+=Parallel::size())
+          scalarFlux += _prob.weights[n]*_cellFlux[_cellFluxIndex(i,n,g,subCell)];
+        _reducedScalarFlux[(i*G + g)*_numSubCells + subCell] = scalarFlux/sumOfWeights;
+      }
+    }
+  }
+  Parallel::sumAll(_reducedScalarFlux, size);
+  _reducedScalarFluxValid = true;
+
+  if (_prob.scatterAnisotropy == 0)
+    return;
+
+  if (_momentDegree.size() == 0)
+    _buildMomentOperators();
+  int M = _numMoments;
+  _reducedFluxMoments.assign(size*M, 0.0);
+
+  #pragma omp parallel for
+  for (long i=0; i<_prob.numCells; i++) {
+    for (int subCell=0; subCell<_numSubCells; subCell++) {
+      for (int g=0; g<G; g++) {
+        double* moments = &_reducedFluxMoments[((i*_numSubCells + subCell)*G + g)*M];
+        for (int n=Parallel::rank(); n<Q; n+=Parallel::size()) {
+          double psi = _cellFlux[_cellFluxIndex(i,n,g,subCell)];
+          for (int k=0; k<M; k++)
+            moments[k] += _discreteToMoment[k*Q + n]*psi;
+        }
+      }
+    }
+  }
+  Parallel::sumAll(&_reducedFluxMoments[0], size*M);
+  _reducedFluxMomentsValid = true;
+}
+
+/// Sum the boundary edge fluxes of the directions swept on each rank
+/**
+ *  Reflecting boundaries read the fluxes of other directions on the same
+ *  boundary edge, so only the boundary edges are exchanged.
+ */
+void
+SolverMOC::_sumBoundaryEdgeFlux()
+{
+  int Q = _prob.quadOrder;
+  long block = 2*_numStoredGroups;
+
+  if (_boundaryEdges.size() == 0) {
+    std::vector<char> listed(_prob.numEdges, 0);
+    UltraLightElement element;
+    for (long be=0; be < mesh->boundaryElements.size(); be++) {
+      long elementID = mesh->boundaryElements[be];
+      mesh->getCurrentElementFromID(elementID, element);
+      for (int v=0; v<3; v++) {
+        if (element.neighborID[v] >= 0) continue;
+        long edge = mesh->getEdgeID(elementID, element.neighborID[v]);
+        if (edge < 0 || listed[edge]) continue;
+        listed[edge] = 1;
+        _boundaryEdges.push_back(edge);
+      }
+    }
+  }
+
+  std::vector<double> buffer(_boundaryEdges.size()*Q*block, 0.0);
+  #pragma omp parallel for
+  for (long k=0; k<_boundaryEdges.size(); k++)
+    for (int n=0; n<Q; n++)
+      if (_ownsDirection(n))
+        std::copy(_solution + _edgeOffset(_boundaryEdges[k], n),
+                  _solution + _edgeOffset(_boundaryEdges[k], n) + block,
+                  &buffer[(k*Q + n)*block]);
+
+  Parallel::sumAll(buffer.data(), buffer.size());
+
+  #pragma omp parallel for
+  for (long k=0; k<_boundaryEdges.size(); k++)
+    for (int n=0; n<Q; n++)
+      std::copy(&buffer[(k*Q + n)*block], &buffer[(k*Q + n)*block] + block,
+                _solution + _edgeOffset(_boundaryEdges[k], n));
+}
+
+/**
+ *  Replace the cell (and edge) fluxes of directions owned by other ranks by
+ *  their owners' values.  Either array may be NULL.
+ */
+void
+SolverMOC::_sumOwnedDirections(double* cellFlux, double* edgeFlux)
+{
+  int G = _prob.numGroups;
+  int Q = _prob.quadOrder;
+  if (cellFlux) {
+    #pragma omp parallel for
+    for (long i=0; i<_prob.numCells; i++)
+      for (int n=0; n<Q; n++)
+        if (!_ownsDirection(n))
+          for (int g=0; g<G; g++)
+            for (int subCell=0; subCell<_numSubCells; subCell++)
+              cellFlux[_cellFluxIndex(i,n,g,subCell)] = 0.0;
+    Parallel::sumAll(cellFlux, _numPhaseSpaceDOF);
+  }
+  if (edgeFlux) {
+    // Edge DOFs are ordered (edge, angle, group, edge location)
+    #pragma omp parallel for
+    for (long e=0; e<_prob.numEdges; e++)
+      for (int n=0; n<Q; n++)
+        if (!_ownsDirection(n))
+          for (long b=0; b<2*G; b++)
+            edgeFlux[(e*Q + n)*2*G + b] = 0.0;
+    Parallel::sumAll(edgeFlux, _numDOF);
+  }
+}
+
+/// Get spherical representation of ordinates
+/**
+ *  Calculate (theta, mu) coordinates from the input (omega_x, omega_y, omega_z).
+ *  Also get the mapping between each ordinate, u, and its negative, -v.  Currently
+ *  only two-dimensional problems are assumed, so the polar cosine, mu, is assumed
+ *  symmetric about the xy-plane.
+ */
+void
+SolverMOC::_calculateSphericalQuadrature()
+{
+  // Polar coordinate
+  _mu = _prob.omega_z;
+
+  // Azimuthal coordinate
+  _theta.resize(_prob.quadOrder, 0.0);
+  for (int i=0; i<_prob.quadOrder; i++)
+    _theta[i] = _getAngleFromVector(_prob.omega_x[i], _prob.omega_y[i]);
+
+  // Aggregate azimuthal negative directions
+  _negDir.resize(_prob.quadOrder, -1);
+  for (int i=0; i<_prob.quadOrder; i++) {
+    bool found;
+    found = false;
+    int j;
+    for (j=0; j<_prob.quadOrder; j++) {
+      if (_mu[i] == _mu[j]) {
+        if ( std::abs(_theta[i] - fmod(_theta[j] + pi, 2*pi)) < 1e-8) {
+          found = true;
+          break;
+        }
+      }
+    }
+    if (!found)
+      LOG_ERR("Could not find negative direction for ordinate ", i);
+    else
+      _negDir[i] = j;
+  }
+}
+
+int
+SolverMOC::_getReflectedDirection(int i, double nx, double ny, double& OmegaDotn)
+{
+  int& j = _reflectedDirection(nx, ny, i);
+  if (j == -2) {
+    double Omegapx = -2.0*OmegaDotn*nx + sqrt(1.0-pow(_mu[i],2))*cos(_theta[i]);
+    double Omegapy = -2.0*OmegaDotn*ny + sqrt(1.0-pow(_mu[i],2))*sin(_theta[i]);
+    double thetap = _getAngleFromVector(Omegapx, Omegapy);
+
+    j = -1;
+    for (int jp=0; jp<_prob.quadOrder; jp++) {
+      if (_mu[jp] == _mu[i] && std::abs(_theta[jp] - thetap) < 1e-8) {
+        j = jp;
+        break;
+      }
+    }
+    if (j < 0) {
+      LOG_ERR("Could not find reflected direction for ordinate ", i);
+      LOG_DBG(nx," ",ny);
+      LOG_DBG(Omegapx," ",Omegapy);
+    }
+  }
+
+  _linkReflectedDirections(i, j);
+  return j;
+}
+
+/// Calculate the azimuthal angle of a vector with components dx and dy
+double
+SolverMOC::_getAngleFromVector(double dx, double dy)
+{
+  double phi;
+  if (std::abs(dx) < 1.0e-8) {
+    if (dy > 0.0)
+      phi = pi/2;
+    else
+      phi = 3*pi/2;
+  }
+  else {
+    phi = fmod(2.0*pi + atan2(dy,dx), 2.0*pi);
+  }
+  return phi;
+}
+
+/// Apply boundary conditions for one direction (or all, if angle is negative)
+/**
+ *  The boundary geometry, reflected directions and boundary sources are
+ *  resolved into a plan on the first call; afterwards this is only a gather.
+ */
+void
+SolverMOC::_applyBoundaryConditions(int angle)
+{
+  if (_bcPlan.size() == 0)
+    _buildBoundaryPlan();
+
+  _executeBoundaryPlan(angle);
+}
+
+void
+SolverMOC::_calculateSource()
+{
+  PerfStats X("SolverMOC::_calculateSource");
+
+  _getExternalSource();
+  if (sourceConfig.hasFissionSource)
+    _addFissionSource();
+  _addScatterSource();
+}
+
+void
+SolverMOC::_getExternalSource()
+{
+  // Get external source
+  if (sourceConfig.hasExternalSource) {
+    #pragma omp parallel for
+    for (long i=0; i<_prob.numCells; i++) {
+      if (!_ownsCell(i)) continue;
+      for (int n=0; n<_prob.quadOrder; n++) {
+        for (int g=_firstStoredGroup; g<_endStoredGroup(); g++) {
+          double extSrc = *_prob.getExtSource(i,n,g) * sourceScaling;
+          for (int subCell=0; subCell<_numSubCells; subCell++)
+            _source[_cellFluxIndex(i,n,g,subCell)] = extSrc;
+        }
+      }
+    }
+  }
+  else {
+    for (long i=0; i<_numPhaseSpaceDOF; i++)
+      _source[i] = 0.0;
+  }
+}
+
+void
+SolverMOC::_addFissionSource()
+{
+  // Update the in-iteration part of the fission density for a Wielandt shift
+  if (_lambdaShift != 0.0)
+    _calculateFissionDensity(_fissionDensity);
+
+  double fissSrc;
+
+  #pragma omp parallel for private(fissSrc)
+  for (long i=0; i<_prob.numCells; i++) {
+    if (!_ownsCell(i)) continue;
+    for (int subCell=0; subCell<_numSubCells; subCell++) {
+      for (int g=_firstStoredGroup; g<_endStoredGroup(); g++) {
+        fissSrc = _getFissionSource(i, g, subCell);
+        for (int n=0; n<_prob.quadOrder; n++)
+          _source[_cellFluxIndex(i,n,g,subCell)] += fissSrc;
+      }
+    }
+  }
+}
+
+void
+SolverMOC::_addScatterSource()
+{
+  if (_prob.scatterAnisotropy > 0)
+    _addAnisotropicScatterSource();
+  else
+    _addIsotropicScatterSource();
+}
+
+void
+SolverMOC::_addIsotropicScatterSource()
+{
+  double scattXS, scalFlux;
+
+  #pragma omp parallel for private(scattXS,scalFlux)
+  for (long i=0; i<_prob.numCells; i++) {
+    if (!_ownsCell(i)) continue;
+    for (int subCell=0; subCell<_numSubCells; subCell++) {
+      for (int gp=0; gp<_prob.numGroups; gp++) {
+        scalFlux = getSubCellScalarFlux(i, gp, subCell);
+        for (int g=_firstStoredGroup; g<_endStoredGroup(); g++) {
+          if (!_groupActive[g]) continue;
+          scattXS = *mesh->getElementMat(i)->getSigma_s(gp+1,g+1);
+          for (int n=0; n<_prob.quadOrder; n++)
+            _source[_cellFluxIndex(i,n,g,subCell)] += scalFlux*scattXS;
+        }
+      }
+    }
+  }
+}
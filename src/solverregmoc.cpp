@@ -1,50 +1,58 @@
 #include "solverregmoc.h"
 #include "global.h"
 #include "sweeper.h"
+#include <algorithm>
 
 SolverRegMOC::SolverRegMOC(TransportProblem &tp)
-  : SolverBase(tp)
+  : SolverMOC(tp)
 {
   // Define number of DOFs
   _numDOF = 2 * tp.numEdges * tp.quadOrder * tp.numGroups;
   _numPhaseSpaceDOF = 4 * tp.numCells * tp.quadOrder * tp.numGroups;
   _numSpaceDOF = tp.numCells;
-  LOG_DBG("num dof = ",_numDOF);
-  LOG_DBG("num space dof = ", tp.numCells);
-
-  mesh = dynamic_cast<MoabMesh*>(_prob.mesh);
-  if (!mesh) {
-    LOG_ERR("This solver needs a MOAB mesh or a mesh interface with integrated sweep methods.");
+  _numSubCells = 4;
+  if (!mesh)
     return;
-  }
-
-  // Allocate and initialize solution and source arrays
-  _solution     = new double [_numDOF];
-  _residual     = new double [_numDOF];
-  _solutionPrev = new double [_numDOF];
-  _source       = new double [_numPhaseSpaceDOF];
-  _cellFlux     = new double [_numPhaseSpaceDOF];
-  for (long i=0; i<_numDOF; i++) {
-    _solution[i] = 0.0;
-    _solutionPrev[i] = 0.0;
-  }
-  for (long i=0; i<_numPhaseSpaceDOF; i++) {
-    _source[i] = 0.0;
-    _cellFlux[i] = 1.0;
-  }
 
-  _mapDOFs();
+  // Sweep plans are only filled if cacheSweepGeometry is requested
+  _sweepPlan.resize(_prob.quadOrder);
+  _sweepBatchStart.resize(_prob.quadOrder);
 
-  _calculateSphericalQuadrature();
+  _selectKernels();
 }
 
 SolverRegMOC::~SolverRegMOC()
 {
-  delete [] _solution;
-  delete [] _residual;
-  delete [] _solutionPrev;
-  delete [] _source;
-  delete [] _cellFlux;
+  _freeAngularArray(_solution);
+  _freeAngularArray(_residual);
+  _freeAngularArray(_solutionPrev);
+  _freeAngularArray(_source);
+  _freeAngularArray(_cellFlux);
+}
+
+/// Allocate solution and source arrays
+/**
+ *  They are initialized (first touched) by setupDecomposition once the thread
+ *  decomposition is known.  The arrays only hold the stored groups.  The DOF
+ *  map is skipped out of core, where its entries would take more memory than
+ *  the angular fluxes themselves, and with group block or sweep front storage.
+ */
+void
+SolverRegMOC::_allocateStorage()
+{
+  _numDOF = _numEdgeDOFs();
+  _numPhaseSpaceDOF = 4 * _numLocalCells * _prob.quadOrder * _numStoredGroups;
+  LOG_DBG("num dof = ",_numDOF);
+  LOG_DBG("num space dof = ", _prob.numCells);
+
+  _solution     = _allocateAngularArray(_numDOF);
+  _residual     = _allocateAngularArray(_numDOF);
+  _solutionPrev = _allocateAngularArray(_numDOF);
+  _source       = _allocateAngularArray(_numPhaseSpaceDOF);
+  _cellFlux     = _allocateAngularArray(_numPhaseSpaceDOF);
+
+  if (_outOfCoreDirectory.empty() && !_groupBlockStorage() && !_sweepFrontStorage)
+    _mapDOFs();
 }
 
 /// Map degrees-of-freedom
@@ -54,307 +62,322 @@ SolverRegMOC::_mapDOFs()
   DOFlist.reserve(_numDOF);
 
   for (long i=0; i<_prob.numNodes; i++) {
+    if (!_storesEdge(i)) continue;
     for (int n=0; n<_prob.quadOrder; n++) {
       for (int g=0; g<_prob.numGroups; g++) {
 	for (int c=0; c<2; c++) {
 	  DOFlist.push_back( DOFObj(i,n,g,c) );
-	  DOFmap.insert( std::pair<DOFObj, double*>(DOFlist[_dofIndex(i,n,g,c)], &_solution[_dofIndex(i,n,g,c)]) );
+	  DOFmap.insert( std::pair<DOFObj, double*>(DOFlist.back(), &_solution[_dofIndex(i,n,g,c)]) );
 	}
       }
     }
   }
 }
 
-/// Get spherical representation of ordinates
+/// Mesh sweep
 /**
- *  Calculate (theta, mu) coordinates from the input (omega_x, omega_y, omega_z).
- *  Also get the mapping between each ordinate, u, and its negative, -v.  Currently
- *  only two-dimensional problems are assumed, so the polar cosine, mu, is assumed
- *  symmetric about the xy-plane.
+ *  Uses the cached sweep plan if requested, otherwise the common traversal.
+ *  Batched sources use the common traversal, whose element kernel solves all
+ *  of them.
  */
 void
-SolverRegMOC::_calculateSphericalQuadrature()
+SolverRegMOC::_sweep(int n, int firstGroup, int lastGroup)
 {
-  // Polar coordinate
-  _mu = _prob.omega_z;
-
-  // Azimuthal coordinate
-  _theta.resize(_prob.quadOrder, 0.0);
-  for (int i=0; i<_prob.quadOrder; i++)
-    _theta[i] = _getAngleFromVector(_prob.omega_x[i], _prob.omega_y[i]);
-
-  // Aggregate azimuthal negative directions
-  _negDir.resize(_prob.quadOrder, -1);
-  for (int i=0; i<_prob.quadOrder; i++) {
-    bool found;
-    found = false;
-    int j;
-    for (j=0; j<_prob.quadOrder; j++) {
-      if (_mu[i] == _mu[j]) {
-        if ( std::abs(_theta[i] - fmod(_theta[j] + pi, 2*pi)) < 1e-8) {
-          found = true;
-          break;
-        }
-      }
-    }
-    if (!found)
-      LOG_ERR("Could not find negative direction for ordinate ", i);
-    else
-      _negDir[i] = j;
-  }
-}
+  if (!_ownsDirection(n))
+    return;
 
-int
-SolverRegMOC::_getReflectedDirection(int i, double nx, double ny, double& OmegaDotn)
-{
-  double Omegapx = -2.0*OmegaDotn*nx + sqrt(1.0-pow(_mu[i],2))*cos(_theta[i]);
-  double Omegapy = -2.0*OmegaDotn*ny + sqrt(1.0-pow(_mu[i],2))*sin(_theta[i]);
-  double thetap = _getAngleFromVector(Omegapx, Omegapy);
-
-  bool found;
-  found = false;
-  int j;
-  for (j=0; j<_prob.quadOrder; j++) {
-    if (_mu[j] == _mu[i]) {
-      if ( std::abs(_theta[j] - thetap) < 1e-8) {
-        found = true;
-        break;
-      }
-    }
-  }
-  if (!found) {
-    LOG_ERR("Could not find reflected direction for ordinate ", i);
-    LOG_DBG(nx," ",ny);
-    LOG_DBG(Omegapx," ",Omegapy);
-    return -1;
-  }
+  if (_cacheSweepGeometry && _numBatchedSources == 1)
+    _sweepCached(n, firstGroup, lastGroup);
   else
-    return j;
+    SolverMOC::_sweep(n, firstGroup, lastGroup);
 }
 
+/// Build the cached sweep plan before group blocks of direction n share it
+void
+SolverRegMOC::_prepareSweep(int n)
+{
+  if (_cacheSweepGeometry && _numBatchedSources == 1 && _ownsDirection(n) && _sweepPlan[n].size() == 0)
+    _buildSweepPlan(n);
+}
 
-/// Implementation of the LocalMOC solver
+/// Sweep order of direction n, batched like the cached sweep plan if it is used
 void
-SolverRegMOC::solve()
+SolverRegMOC::_sweepOrder(int n, std::vector<long>& order, std::vector<long>& batchStart)
 {
-  PerfStats X("SolverRegMOC::solve");
-
-  double convRInf = 1e10;
-  int innerIter;
-  int scatterIter;
-  int fissionIter;
-  double* fissionSrcFlux = NULL;
-  sourceConfig.hasFissionSource = false;
-
-  for (fissionIter=0; fissionIter<_maxIters; fissionIter++) {
-    if (sourceConfig.hasFissionSource)
-      fissionSrcFlux = copySolution(fissionSrcFlux);
-    else
-      fissionSrcFlux = _solution;
-
-    // Perform scattering iterations
-    for (scatterIter=0; scatterIter<_maxIters; scatterIter++) {
-      _saveOldSolution();
-      _calculateSource(fissionSrcFlux);
-      _applyBoundaryConditions();
-      //for (innerIter=0; innerIter<_maxIters; innerIter++) {
-      #pragma omp parallel for
-      for (int n=0; n<_prob.quadOrder; n++) {
-        _sweep(n);
-      }
-      // Test for convergence of inner iterations
-      convRInf = calculateRInfSolutionNorm(_solutionPrev);
-      //LOG_DBG("  ",convRInf);
-      if (convRInf < _convRInfTol) break;
-    }
-    // Test for convergence of fission iterations
-    printIterStatus("scatter", scatterIter, convRInf, _convRInfTol);
-    convRInf = calculateRInfSolutionNorm(fissionSrcFlux);
-    if (convRInf < _convRInfTol) break;
+  if (!_cacheSweepGeometry) {
+    SolverMOC::_sweepOrder(n, order, batchStart);
+    return;
   }
-  if (sourceConfig.hasFissionSource)
-    delete [] fissionSrcFlux;
+
+  _prepareSweep(n);
+  order.clear();
+  for (long e=0; e<_sweepPlan[n].size(); e++)
+    order.push_back(_sweepPlan[n][e].elementID);
+  batchStart = _sweepBatchStart[n];
 }
 
-/// Mesh sweep
+/// Solve all active groups of one element
 /**
- *  This function sweeps the mesh in the order in which the elements are listed
- *  in memory--essentially arbitray.
- *
- *  A MoabMesh must be used.
+ *  Uses the kernel specialized for the number of groups, unless the angular
+ *  arrays only hold a block of the groups.
  */
 void
-SolverRegMOC::_sweep(int n)
+SolverRegMOC::_solveElement(UltraLightElement& element, long elementID, int n,
+                            int firstGroup, int lastGroup)
 {
-  UltraLightElement element2;
-  long elementID;
-  double x[3], y[3], z[3];
-  long neighbor[3];
-  Sweeper sweep(mesh, n);
-  while ((elementID = sweep.getNextElementID()) >= 0) {
-    mesh->getCurrentElementFromID(elementID, element2);
+  if (_numStoredGroups == _prob.numGroups)
+    (this->*_solveElementGroups)(element, elementID, n, firstGroup, lastGroup);
+  else
+    _solveElementKernel<0>(element, elementID, n, firstGroup, lastGroup);
+}
 
-    int v0,v1,v2;
-    int blockID;
-    double theta;
-    TriangleDescriptorReg tri;
-    _getTriangleOrientation(element2, n, tri, blockID, theta, v0, v1, v2);
-
-    double sigma;
-    //double psi0b,psi0a,psi1b,psi1a,psi2a,psi2b;
-    double psi0,psi1,psi2,psi3,psi4,psi5;
-    long edgeIndex;
-    for (int g = 0; g<_prob.numGroups; g++) {
-      // EXTERNAL CALL 
-      sigma = *mesh->getElementMat(elementID)->getSigma_t(g+1);
-      if (blockID==1) {
-        if (tri.vertexNeighbor1 >= 0) {
-	  edgeIndex = mesh->getEdgeID(elementID,tri.vertexNeighbor1);
-          psi4 = _solution[ _dofIndex(edgeIndex,n,g,0)];
-          psi5 = _solution[ _dofIndex(edgeIndex,n,g,1)];
-        }
-        else {
-          psi4 = 0.0;
-          psi5 = 0.0;
-          psi4 = _bdryFlux[DOFObj(6*elementID+2,n,g)];
-          psi5 = _bdryFlux[DOFObj(6*elementID+3,n,g)];
-        }
-        if (tri.vertexNeighbor2 >= 0) {
-	  edgeIndex = mesh->getEdgeID(elementID,tri.vertexNeighbor2);
-          psi0 = _solution[ _dofIndex(edgeIndex,n,g,0)];
-          psi1 = _solution[ _dofIndex(edgeIndex,n,g,1)];
-        }
-        else {
-          psi0 = 0.0;
-          psi1 = 0.0;
-          psi0 = _bdryFlux[DOFObj(6*elementID+4,n,g)];
-          psi1 = _bdryFlux[DOFObj(6*elementID+5,n,g)];
-        }
-        tri.sigma = sigma;
-        tri.psi0 = psi0;
-        tri.psi1 = psi1;
-        tri.psi4 = psi4;
-        tri.psi5 = psi5;
-        triangleSolveA(tri, theta, _theta[n], _mu[n], elementID, n, g);
-      }
-      else if (blockID==2) {
-        // e01 to v2
-        if (tri.edgeNeighbor >= 0) {
-	  edgeIndex = mesh->getEdgeID(elementID,tri.edgeNeighbor);
-          psi0 = _solution[ _dofIndex(edgeIndex,n,g,0) ];
-          psi1 = _solution[ _dofIndex(edgeIndex,n,g,1) ];
-        }
-        else {
-          psi0 = 0.0;
-          psi1 = 0.0;
-          psi0 = _bdryFlux[DOFObj(6*elementID,n,g)];
-          psi1 = _bdryFlux[DOFObj(6*elementID+1,n,g)];
-        }
-        tri.sigma = sigma;
-        tri.psi0 = psi0;
-        tri.psi1 = psi1;
-        triangleSolveB(tri, theta, _theta[n], _mu[n], elementID, n, g);
-      }
-      else if (blockID==3) {
-        // v1 to e20
-        if (tri.vertexNeighbor1 >= 0) {
-	  edgeIndex = mesh->getEdgeID(elementID,tri.vertexNeighbor1);
-          psi0 = _solution[ _dofIndex(edgeIndex,n,g,0)];
-          psi1 = _solution[ _dofIndex(edgeIndex,n,g,1)];
+/// Element solve kernel
+/**
+ *  The orientation is found once for all groups and batched sources.  The
+ *  sub-cell and edge DOFs of the groups of one direction are contiguous (4
+ *  and 2 apart), so their offsets are found once per element and the group
+ *  loop steps through them.  Only boundary fluxes, which all batched sources
+ *  share, are looked up per group.
+ */
+template <int G>
+void
+SolverRegMOC::_solveElementKernel(UltraLightElement& element, long elementID, int n,
+                                  int firstGroup, int lastGroup)
+{
+  int v0,v1,v2;
+  int blockID;
+  double theta;
+  TriangleDescriptorReg tri;
+  _getTriangleOrientation(element, n, tri, blockID, theta, v0, v1, v2);
+  if (blockID == 0) return;
+
+  const int numStoredGroups = G > 0 ? G : _numStoredGroups;
+  const int numGroups = (G > 0 && lastGroup - firstGroup == G) ? G : lastGroup - firstGroup;
+  long cellOffset = 4L*numStoredGroups*(_cellIndex(elementID)*_prob.quadOrder + n)
+    + 4*(firstGroup - _firstStoredGroup);
+  Material* mat = mesh->getElementMat(elementID);
+
+  for (int b=0; b<_numBatchedSources; b++) {
+    const double* source = _batchedSource(b) + cellOffset;
+    double* cellFlux = _batchedCellFlux(b) + cellOffset;
+    const double* solution = _batchedSolution(b);
+
+    // Blocks 1, 3, 5 are vertex to edge; 2, 4, 6 are edge to vertex
+    if (blockID % 2 == 1) {
+      const double* in2 = (tri.vertexNeighbor2 >= 0) ? solution + _dofIndex(tri.vertexEdge2,n,firstGroup) : NULL;
+      const double* in1 = (tri.vertexNeighbor1 >= 0) ? solution + _dofIndex(tri.vertexEdge1,n,firstGroup) : NULL;
+      double* out = _outgoingBatchedDOFs(tri.edgeEdge, n, firstGroup, b);
+      for (int k=0; k<numGroups; k++) {
+        int g = firstGroup + k;
+        if (!_groupActive[g]) continue;
+        tri.sigma = *mat->getSigma_t(g+1);
+        if (in2) {
+          tri.psi0 = in2[2*k];
+          tri.psi1 = in2[2*k+1];
         }
         else {
-          psi0 = 0.0;
-          psi1 = 0.0;
-          psi0 = _bdryFlux[DOFObj(6*elementID+2,n,g)];
-          psi1 = _bdryFlux[DOFObj(6*elementID+3,n,g)];
+          _gatherEdgeFlux(tri.vertexNeighbor2, tri.vertexEdge2, 6*elementID+4, n, g, tri.psi0, tri.psi1);
         }
-        if (tri.vertexNeighbor2 >= 0) {
-	  edgeIndex = mesh->getEdgeID(elementID,tri.vertexNeighbor2);
-          psi2 = _solution[ _dofIndex(edgeIndex,n,g,0)];
-          psi3 = _solution[ _dofIndex(edgeIndex,n,g,1)];
+        if (in1) {
+          tri.psi4 = in1[2*k];
+          tri.psi5 = in1[2*k+1];
         }
         else {
-          psi2 = 0.0;
-          psi3 = 0.0;
-          psi2 = _bdryFlux[DOFObj(6*elementID+4,n,g)];
-          psi3 = _bdryFlux[DOFObj(6*elementID+5,n,g)];
+          _gatherEdgeFlux(tri.vertexNeighbor1, tri.vertexEdge1, 6*elementID+2, n, g, tri.psi4, tri.psi5);
         }
-        tri.psi0 = psi2;
-        tri.psi1 = psi3;
-        tri.psi4 = psi0;
-        tri.psi5 = psi1;
-        tri.sigma = sigma;
+        _loadSource(tri, source + 4*k);
         triangleSolveA(tri, theta, _theta[n], _mu[n], elementID, n, g);
+        _storeCellFlux(tri, cellFlux + 4*k);
+        out[2*k] = tri.psi3;
+        out[2*k+1] = tri.psi2;
       }
-      else if (blockID==4) {
-        // e12 to v0
-        if (tri.edgeNeighbor >= 0) {
-	  edgeIndex = mesh->getEdgeID(elementID,tri.edgeNeighbor);
-          psi2 = _solution[ _dofIndex(edgeIndex,n,g,0) ];
-          psi3 = _solution[ _dofIndex(edgeIndex,n,g,1) ];
+    }
+    else {
+      const double* in = (tri.edgeNeighbor >= 0) ? solution + _dofIndex(tri.edgeEdge,n,firstGroup) : NULL;
+      double* out1 = _outgoingBatchedDOFs(tri.vertexEdge1, n, firstGroup, b);
+      double* out2 = _outgoingBatchedDOFs(tri.vertexEdge2, n, firstGroup, b);
+      for (int k=0; k<numGroups; k++) {
+        int g = firstGroup + k;
+        if (!_groupActive[g]) continue;
+        tri.sigma = *mat->getSigma_t(g+1);
+        if (in) {
+          tri.psi0 = in[2*k];
+          tri.psi1 = in[2*k+1];
         }
         else {
-          psi2 = 0.0;
-          psi3 = 0.0;
-          psi2 = _bdryFlux[DOFObj(6*elementID,n,g)];
-          psi3 = _bdryFlux[DOFObj(6*elementID+1,n,g)];
+          _gatherEdgeFlux(tri.edgeNeighbor, tri.edgeEdge, 6*elementID, n, g, tri.psi0, tri.psi1);
         }
-        tri.psi0 = psi2;
-        tri.psi1 = psi3;
-        tri.sigma = sigma;
+        _loadSource(tri, source + 4*k);
         triangleSolveB(tri, theta, _theta[n], _mu[n], elementID, n, g);
+        _storeCellFlux(tri, cellFlux + 4*k);
+        out1[2*k] = tri.psi3;
+        out1[2*k+1] = tri.psi2;
+        out2[2*k] = tri.psi5;
+        out2[2*k+1] = tri.psi4;
       }
-      else if (blockID==5) {
-        // v2 to e01
-        if (tri.vertexNeighbor1 >= 0) {
-	  edgeIndex = mesh->getEdgeID(elementID,tri.vertexNeighbor1);
-          psi2 = _solution[ _dofIndex(edgeIndex,n,g,0)];
-          psi3 = _solution[ _dofIndex(edgeIndex,n,g,1)];
-        }
-        else {
-          psi2 = 0.0;
-          psi3 = 0.0;
-          psi2 = _bdryFlux[DOFObj(6*elementID+2,n,g)];
-          psi3 = _bdryFlux[DOFObj(6*elementID+3,n,g)];
-        }
-        if (tri.vertexNeighbor2 >= 0) {
-	  edgeIndex = mesh->getEdgeID(elementID,tri.vertexNeighbor2);
-          psi4 = _solution[ _dofIndex(edgeIndex,n,g,0)];
-          psi5 = _solution[ _dofIndex(edgeIndex,n,g,1)];
-        }
-        else {
-          psi4 = 0.0;
-          psi5 = 0.0;
-          psi4 = _bdryFlux[DOFObj(6*elementID+4,n,g)];
-          psi5 = _bdryFlux[DOFObj(6*elementID+5,n,g)];
+    }
+  }
+}
+
+/// Mesh sweep with cached element orientations
+/**
+ *  The orientation of every element is computed once per direction.  Elements
+ *  are grouped into batches that (1) only depend on elements of earlier
+ *  batches and (2) share one orientation case, so each batch runs a single
+ *  kernel over its elements without branching on the orientation.
+ */
+void
+SolverRegMOC::_sweepCached(int n, int firstGroup, int lastGroup)
+{
+  if (_sweepPlan[n].size() == 0)
+    _buildSweepPlan(n);
+
+  std::vector<SweepPlanElement>& plan = _sweepPlan[n];
+  std::vector<long>& batchStart = _sweepBatchStart[n];
+  for (long b=0; b+1<batchStart.size(); b++) {
+    bool vertexToEdge = (plan[batchStart[b]].blockID % 2 == 1);
+    for (int g = firstGroup; g<lastGroup; g++) {
+      if (!_groupActive[g]) continue;
+      if (vertexToEdge) {
+        for (long e=batchStart[b]; e<batchStart[b+1]; e++) {
+          TriangleDescriptorReg tri = plan[e].tri;
+          _solveVertexToEdge(tri, plan[e].theta, plan[e].elementID, n, g);
         }
-        tri.psi0 = psi4;
-        tri.psi1 = psi5;
-        tri.psi4 = psi2;
-        tri.psi5 = psi3;
-        tri.sigma = sigma;
-        triangleSolveA(tri, theta, _theta[n], _mu[n], elementID, n, g);
       }
-      else if (blockID==6) {
-        // e20 to v1
-        if (tri.edgeNeighbor >= 0) {
-	  edgeIndex = mesh->getEdgeID(elementID,tri.edgeNeighbor);
-          psi4 = _solution[ _dofIndex(edgeIndex,n,g,0) ];
-          psi5 = _solution[ _dofIndex(edgeIndex,n,g,1) ];
-        }
-        else {
-          psi4 = 0.0;
-          psi5 = 0.0;
-          psi4 = _bdryFlux[DOFObj(6*elementID,n,g)];
-          psi5 = _bdryFlux[DOFObj(6*elementID+1,n,g)];
+      else {
+        for (long e=batchStart[b]; e<batchStart[b+1]; e++) {
+          TriangleDescriptorReg tri = plan[e].tri;
+          _solveEdgeToVertex(tri, plan[e].theta, plan[e].elementID, n, g);
         }
-        tri.psi0 = psi4;
-        tri.psi1 = psi5;
-        tri.sigma = sigma;
-        triangleSolveB(tri, theta, _theta[n], _mu[n], elementID, n, g);
       }
-    } // loop over groups
-  } // loop over elements
+    }
+  }
+}
+
+/**
+ *  Compute and cache the element orientations for direction n, ordered by
+ *  sweep level (one more than the deepest upwind neighbor) and then by
+ *  orientation case
+ */
+void
+SolverRegMOC::_buildSweepPlan(int n)
+{
+  std::vector<SweepPlanElement>& plan = _sweepPlan[n];
+  std::vector<int> level(_prob.numCells, -1);
+
+  UltraLightElement element2;
+  long elementID;
+  Sweeper sweep(mesh, n + _prob.sweepOrderOffset);
+  while ((elementID = sweep.getNextElementID()) >= 0) {
+    if (!_ownsCell(elementID)) continue;
+    mesh->getCurrentElementFromID(elementID, element2);
+
+    SweepPlanElement entry;
+    int v0,v1,v2;
+    entry.elementID = elementID;
+    _getTriangleOrientation(element2, n, entry.tri, entry.blockID, entry.theta, v0, v1, v2);
+    if (entry.blockID == 0) continue;
+
+    // Only upwind neighbors that precede this element in the sweep order count
+    int upwindLevel = -1;
+    if (entry.blockID % 2 == 1) {
+      if (entry.tri.vertexNeighbor1 >= 0)
+        upwindLevel = std::max(upwindLevel, level[entry.tri.vertexNeighbor1]);
+      if (entry.tri.vertexNeighbor2 >= 0)
+        upwindLevel = std::max(upwindLevel, level[entry.tri.vertexNeighbor2]);
+    }
+    else if (entry.tri.edgeNeighbor >= 0) {
+      upwindLevel = level[entry.tri.edgeNeighbor];
+    }
+    level[elementID] = upwindLevel + 1;
+    entry.level = upwindLevel + 1;
+
+    plan.push_back(entry);
+  }
+
+  std::stable_sort(plan.begin(), plan.end(), SweepPlanElement::batchOrder);
+
+  std::vector<long>& batchStart = _sweepBatchStart[n];
+  for (long e=0; e<plan.size(); e++) {
+    if (e == 0 || SweepPlanElement::batchOrder(plan[e-1], plan[e]))
+      batchStart.push_back(e);
+  }
+  batchStart.push_back(plan.size());
+}
+
+/// Gather the two incoming fluxes of an element edge
+void
+SolverRegMOC::_gatherEdgeFlux(long neighbor, long edge, long bdryID, int n, int g,
+                              double& psiA, double& psiB)
+{
+  if (neighbor >= 0) {
+    psiA = _solution[ _dofIndex(edge,n,g,0) ];
+    psiB = _solution[ _dofIndex(edge,n,g,1) ];
+  }
+  else {
+    psiA = _bdryFlux[DOFObj(bdryID,n,g)];
+    psiB = _bdryFlux[DOFObj(bdryID+1,n,g)];
+  }
+}
+
+/**
+ *  Vertex to edge element solve (blocks 1, 3, 5): the incoming fluxes are on
+ *  the two vertex neighbor edges
+ */
+void
+SolverRegMOC::_solveVertexToEdge(TriangleDescriptorReg& tri, double theta, long elementID, int n, int g)
+{
+  tri.sigma = *mesh->getElementMat(elementID)->getSigma_t(g+1);
+  _gatherEdgeFlux(tri.vertexNeighbor2, tri.vertexEdge2, 6*elementID+4, n, g, tri.psi0, tri.psi1);
+  _gatherEdgeFlux(tri.vertexNeighbor1, tri.vertexEdge1, 6*elementID+2, n, g, tri.psi4, tri.psi5);
+  _loadSource(tri, &_source[_dofIndexPS(elementID,n,g)]);
+  triangleSolveA(tri, theta, _theta[n], _mu[n], elementID, n, g);
+  _storeCellFlux(tri, &_cellFlux[_dofIndexPS(elementID,n,g)]);
+
+  double* edgeFlux = _outgoingEdgeDOFs(tri.edgeEdge, n, g);
+  edgeFlux[0] = tri.psi3;
+  edgeFlux[1] = tri.psi2;
+}
+
+/**
+ *  Edge to vertex element solve (blocks 2, 4, 6): the incoming fluxes are on
+ *  the edge neighbor edge
+ */
+void
+SolverRegMOC::_solveEdgeToVertex(TriangleDescriptorReg& tri, double theta, long elementID, int n, int g)
+{
+  tri.sigma = *mesh->getElementMat(elementID)->getSigma_t(g+1);
+  _gatherEdgeFlux(tri.edgeNeighbor, tri.edgeEdge, 6*elementID, n, g, tri.psi0, tri.psi1);
+  _loadSource(tri, &_source[_dofIndexPS(elementID,n,g)]);
+  triangleSolveB(tri, theta, _theta[n], _mu[n], elementID, n, g);
+  _storeCellFlux(tri, &_cellFlux[_dofIndexPS(elementID,n,g)]);
+
+  double* edgeFlux = _outgoingEdgeDOFs(tri.vertexEdge1, n, g);
+  edgeFlux[0] = tri.psi3;
+  edgeFlux[1] = tri.psi2;
+  edgeFlux = _outgoingEdgeDOFs(tri.vertexEdge2, n, g);
+  edgeFlux[0] = tri.psi5;
+  edgeFlux[1] = tri.psi4;
+}
+
+/// Sub-cell sources of an element, given the source of its sub-cell 0
+void
+SolverRegMOC::_loadSource(TriangleDescriptorReg& tri, const double* source)
+{
+  tri.q0 = source[tri.i0];
+  tri.q1 = source[tri.i1];
+  tri.q2 = source[tri.i2];
+  tri.q3 = source[tri.i3];
+}
+
+/// Store the sub-cell fluxes of an element, given the flux of its sub-cell 0
+void
+SolverRegMOC::_storeCellFlux(const TriangleDescriptorReg& tri, double* cellFlux)
+{
+  cellFlux[tri.i0] = tri.cell0;
+  cellFlux[tri.i1] = tri.cell1;
+  cellFlux[tri.i2] = tri.cell2;
+  cellFlux[tri.i3] = tri.cell3;
 }
 
 void
@@ -586,25 +609,32 @@ SolverRegMOC::_getTriangleOrientation(UltraLightElement &element2, int& n,
       tri.d01 = d20;       tri.d12 = d01;       tri.d20 = d12;
     }
   } // triangle orientation selection
+
+  if (blockID != 0) {
+    tri.edgeEdge = mesh->getEdgeID(element2.elementID, tri.edgeNeighbor);
+    tri.vertexEdge1 = mesh->getEdgeID(element2.elementID, tri.vertexNeighbor1);
+    tri.vertexEdge2 = mesh->getEdgeID(element2.elementID, tri.vertexNeighbor2);
+  }
 }
 
 
 void
-SolverRegMOC::_applyBoundaryConditions()
+SolverRegMOC::_buildBoundaryPlan()
 {
+  _initializeBoundaryPlan();
+
   UltraLightElement element;
   long edgeIndex;
-  int nxtNghbr[3] = {1, 2, 0};
-  int* n = new int [4];
   // Loop over all boundary elements
   for (long be=0; be < mesh->boundaryElements.size(); be++) {
     long elementID = mesh->boundaryElements[be];
+    if (!_ownsCell(elementID)) continue;
     
     // Get current element
     mesh->getCurrentElementFromID(elementID, element);
 
     // Loop over all directions
-    for (int n=0; n<_theta.size(); n++) {
+    for (int n=0; n<_prob.quadOrder; n++) {
       TriangleDescriptorReg tri;
       int blockID;
       int v0,v1,v2;
@@ -641,31 +671,32 @@ SolverRegMOC::_applyBoundaryConditions()
             int np = _getReflectedDirection(n, nx, ny, OmegaDotN);
             for (int g=0; g<_prob.numGroups; g++) {
 	      edgeIndex = mesh->getEdgeID(elementID, tri.edgeNeighbor);
-              _bdryFlux[DOFObj(6*elementID,n,g)] = _solution[ _dofIndex(edgeIndex,np,g,0) ];
-              _bdryFlux[DOFObj(6*elementID+1,n,g)] = _solution[ _dofIndex(edgeIndex,np,g,1) ];
+              _addBoundaryPlanEntry(n, DOFObj(6*elementID,n,g), _dofIndex(edgeIndex,np,g,0));
+              _addBoundaryPlanEntry(n, DOFObj(6*elementID+1,n,g), _dofIndex(edgeIndex,np,g,1));
             }
           }
           else if (_prob.globalBC == vacuum) {
             for (int g=0; g<_prob.numGroups; g++) {
-              _bdryFlux[DOFObj(6*elementID,n,g)] = 0.0;
-              _bdryFlux[DOFObj(6*elementID+1,n,g)] = 0.0;
+              _addBoundaryPlanEntry(n, DOFObj(6*elementID,n,g), &_zeroBoundaryFlux);
+              _addBoundaryPlanEntry(n, DOFObj(6*elementID+1,n,g), &_zeroBoundaryFlux);
             }
           }
-          else if (_prob.globalBC == source) {
+          else if (_prob.globalBC == source &&
+                   !_addFileBoundarySource(n, mesh->getEdgeID(elementID,tri.edgeNeighbor), 6*elementID, 2)) {
             for (int bi=0; bi<_prob.nxnyq.size(); bi+=3) {
               if (std::abs(nx-_prob.nxnyq[bi]) < 1.0e-8 && std::abs(ny-_prob.nxnyq[bi+1]) < 1.0e-8) {
 		if (_prob.nxnyq[bi+2]<0.0) {
 		  int np = _getReflectedDirection(n, nx, ny, OmegaDotN);
 		  for (int g=0; g<_prob.numGroups; g++) {
 		    edgeIndex = mesh->getEdgeID(elementID, tri.edgeNeighbor);
-		    _bdryFlux[DOFObj(6*elementID,n,g)] = _solution[ _dofIndex(edgeIndex,np,g,0) ];
-		    _bdryFlux[DOFObj(6*elementID+1,n,g)] = _solution[ _dofIndex(edgeIndex,np,g,1) ];
+		    _addBoundaryPlanEntry(n, DOFObj(6*elementID,n,g), _dofIndex(edgeIndex,np,g,0));
+		    _addBoundaryPlanEntry(n, DOFObj(6*elementID+1,n,g), _dofIndex(edgeIndex,np,g,1));
 		  }
 		}
 		else {
 		  for (int g=0; g<_prob.numGroups; g++) {
-		    _bdryFlux[DOFObj(6*elementID,n,g)] = _prob.nxnyq[bi+2];
-		    _bdryFlux[DOFObj(6*elementID+1,n,g)] = _prob.nxnyq[bi+2];
+		    _addBoundaryPlanEntry(n, DOFObj(6*elementID,n,g), &_prob.nxnyq[bi+2]);
+		    _addBoundaryPlanEntry(n, DOFObj(6*elementID+1,n,g), &_prob.nxnyq[bi+2]);
 		  }
                 }
 	      }
@@ -705,31 +736,32 @@ SolverRegMOC::_applyBoundaryConditions()
               int np = _getReflectedDirection(n, nx, ny, OmegaDotN);
               for (int g=0; g<_prob.numGroups; g++) {
 		edgeIndex = mesh->getEdgeID(elementID,tri.vertexNeighbor1);
-                _bdryFlux[DOFObj(6*elementID+2,n,g)] = _solution[ _dofIndex(edgeIndex,np,g,0) ];
-                _bdryFlux[DOFObj(6*elementID+3,n,g)] = _solution[ _dofIndex(edgeIndex,np,g,1) ];
+                _addBoundaryPlanEntry(n, DOFObj(6*elementID+2,n,g), _dofIndex(edgeIndex,np,g,0));
+                _addBoundaryPlanEntry(n, DOFObj(6*elementID+3,n,g), _dofIndex(edgeIndex,np,g,1));
               }
             }
             else if (_prob.globalBC == vacuum) {
               for (int g=0; g<_prob.numGroups; g++) {
-                _bdryFlux[DOFObj(6*elementID+2,n,g)] = 0.0;
-                _bdryFlux[DOFObj(6*elementID+3,n,g)] = 0.0;
+                _addBoundaryPlanEntry(n, DOFObj(6*elementID+2,n,g), &_zeroBoundaryFlux);
+                _addBoundaryPlanEntry(n, DOFObj(6*elementID+3,n,g), &_zeroBoundaryFlux);
               }
             }
-            else if (_prob.globalBC == source) {
+            else if (_prob.globalBC == source &&
+                     !_addFileBoundarySource(n, mesh->getEdgeID(elementID,tri.vertexNeighbor1), 6*elementID+2, 2)) {
               for (int bi=0; bi<_prob.nxnyq.size(); bi+=3) {
                 if (std::abs(nx-_prob.nxnyq[bi]) < 1.0e-8 && std::abs(ny-_prob.nxnyq[bi+1]) < 1.0e-8) {
 		  if (_prob.nxnyq[bi+2]<0.0) {
 		    int np = _getReflectedDirection(n, nx, ny, OmegaDotN);
 		    for (int g=0; g<_prob.numGroups; g++) {
 		      edgeIndex = mesh->getEdgeID(elementID,tri.vertexNeighbor1);
-		      _bdryFlux[DOFObj(6*elementID+2,n,g)] = _solution[ _dofIndex(edgeIndex,np,g,0) ];
-		      _bdryFlux[DOFObj(6*elementID+3,n,g)] = _solution[ _dofIndex(edgeIndex,np,g,1) ];
+		      _addBoundaryPlanEntry(n, DOFObj(6*elementID+2,n,g), _dofIndex(edgeIndex,np,g,0));
+		      _addBoundaryPlanEntry(n, DOFObj(6*elementID+3,n,g), _dofIndex(edgeIndex,np,g,1));
 		    }
 		  }
 		  else {
 		    for (int g=0; g<_prob.numGroups; g++) {
-		      _bdryFlux[DOFObj(6*elementID+2,n,g)] = _prob.nxnyq[bi+2];
-		      _bdryFlux[DOFObj(6*elementID+3,n,g)] = _prob.nxnyq[bi+2];
+		      _addBoundaryPlanEntry(n, DOFObj(6*elementID+2,n,g), &_prob.nxnyq[bi+2]);
+		      _addBoundaryPlanEntry(n, DOFObj(6*elementID+3,n,g), &_prob.nxnyq[bi+2]);
 		    }
 		  }
 		}
@@ -765,31 +797,32 @@ SolverRegMOC::_applyBoundaryConditions()
               int np = _getReflectedDirection(n, nx, ny, OmegaDotN);
               for (int g=0; g<_prob.numGroups; g++) {
 		edgeIndex = mesh->getEdgeID(elementID,tri.vertexNeighbor2);
-                _bdryFlux[DOFObj(6*elementID+4,n,g)] = _solution[ _dofIndex(edgeIndex,np,g,0) ];
-                _bdryFlux[DOFObj(6*elementID+5,n,g)] = _solution[ _dofIndex(edgeIndex,np,g,1) ];
+                _addBoundaryPlanEntry(n, DOFObj(6*elementID+4,n,g), _dofIndex(edgeIndex,np,g,0));
+                _addBoundaryPlanEntry(n, DOFObj(6*elementID+5,n,g), _dofIndex(edgeIndex,np,g,1));
               }
             }
             else if (_prob.globalBC == vacuum) {
               for (int g=0; g<_prob.numGroups; g++) {
-                _bdryFlux[DOFObj(6*elementID+4,n,g)] = 0.0;
-                _bdryFlux[DOFObj(6*elementID+5,n,g)] = 0.0;
+                _addBoundaryPlanEntry(n, DOFObj(6*elementID+4,n,g), &_zeroBoundaryFlux);
+                _addBoundaryPlanEntry(n, DOFObj(6*elementID+5,n,g), &_zeroBoundaryFlux);
               }
             }
-            else if (_prob.globalBC == source) {
+            else if (_prob.globalBC == source &&
+                     !_addFileBoundarySource(n, mesh->getEdgeID(elementID,tri.vertexNeighbor2), 6*elementID+4, 2)) {
               for (int bi=0; bi<_prob.nxnyq.size(); bi+=3) {
                 if (std::abs(nx-_prob.nxnyq[bi]) < 1.0e-8 && std::abs(ny-_prob.nxnyq[bi+1]) < 1.0e-8) {
 		  if (_prob.nxnyq[bi+2]<0.0) {
 		    int np = _getReflectedDirection(n, nx, ny, OmegaDotN);
 		    for (int g=0; g<_prob.numGroups; g++) {
 		      edgeIndex = mesh->getEdgeID(elementID,tri.vertexNeighbor2);
-		      _bdryFlux[DOFObj(6*elementID+4,n,g)] = _solution[ _dofIndex(edgeIndex,np,g,0) ];
-		      _bdryFlux[DOFObj(6*elementID+5,n,g)] = _solution[ _dofIndex(edgeIndex,np,g,1) ];
+		      _addBoundaryPlanEntry(n, DOFObj(6*elementID+4,n,g), _dofIndex(edgeIndex,np,g,0));
+		      _addBoundaryPlanEntry(n, DOFObj(6*elementID+5,n,g), _dofIndex(edgeIndex,np,g,1));
 		    }
 		  }
 		  else {
 		    for (int g=0; g<_prob.numGroups; g++) {
-		      _bdryFlux[DOFObj(6*elementID+4,n,g)] = _prob.nxnyq[bi+2];
-		      _bdryFlux[DOFObj(6*elementID+5,n,g)] = _prob.nxnyq[bi+2];
+		      _addBoundaryPlanEntry(n, DOFObj(6*elementID+4,n,g), &_prob.nxnyq[bi+2]);
+		      _addBoundaryPlanEntry(n, DOFObj(6*elementID+5,n,g), &_prob.nxnyq[bi+2]);
 		    }
 		  }
 		}
@@ -800,92 +833,159 @@ SolverRegMOC::_applyBoundaryConditions()
 	//}
     }
   }
-  delete [] n;
   
 }
 
 
-/// Calculate the azimuthal angle of a vector with components dx and dy
-double
-SolverRegMOC::_getAngleFromVector(double dx, double dy)
+void
+SolverRegMOC::_addIsotropicScatterSource()
 {
-  double phi;
-  if (std::abs(dx) < 1.0e-8) {
-    if (dy > 0.0)
-      phi = pi/2;
-    else
-      phi = 3*pi/2;
-  }
-  else {
-    phi = atan(dy/dx);
-    if (dx < 0.0)
-      phi += pi;
-    if (phi < 0.0)
-      phi += 2*pi;
-  }
-  return phi;
+  if (_reducedScalarFluxValid)
+    SolverMOC::_addIsotropicScatterSource();
+  else
+    (this->*_isotropicScatterSource)();
 }
 
+/**
+ *  Update the cached sub-cell scalar flux with the kernel specialized for the
+ *  problem size
+ */
 void
-SolverRegMOC::_calculateSource(double* fissionFlux)
+SolverRegMOC::_calculateCachedScalarFlux(bool activeGroupsOnly)
 {
-  PerfStats X("SolverRegMOC::_calculateSource");
-
-  _getExternalSource();
-  //  _addFissionSource(fissionFlux);
-  _addScatterSource();
+  if (_reducedScalarFluxValid)
+    SolverBase::_calculateCachedScalarFlux(activeGroupsOnly);
+  else
+    (this->*_cachedScalarFlux)(activeGroupsOnly);
 }
 
+/// Isotropic scatter source kernel
+/**
+ *  The sub-cell scalar fluxes of a cell are accumulated for all groups at once
+ *  (cell fluxes of one direction are contiguous in group and sub-cell), then
+ *  the scatter source of each active group is added to every direction.
+ */
+template <int G, int Q>
 void
-SolverRegMOC::_getExternalSource()
+SolverRegMOC::_isotropicScatterSourceKernel()
 {
-  // Get external source
-  if (sourceConfig.hasExternalSource) {
-    #pragma omp parallel for
+  const int numGroups = G > 0 ? G : _prob.numGroups;
+  const int quadOrder = Q > 0 ? Q : _prob.quadOrder;
+  const double* weights = &_prob.weights[0];
+
+  double sumOfWeights = 0.0;
+  for (int n=0; n<quadOrder; n++)
+    sumOfWeights += weights[n];
+
+  #pragma omp parallel
+  {
+    double* phi = new double [4*numGroups];
+
+    #pragma omp for
     for (long i=0; i<_prob.numCells; i++) {
-      for (int n=0; n<_prob.quadOrder; n++) {
-        for (int g=0; g<_prob.numGroups; g++) {
-          _source[_dofIndexPS(i,n,g,0)] = *_prob.getExtSource(i,n,g) * sourceScaling;
-          _source[_dofIndexPS(i,n,g,1)] = *_prob.getExtSource(i,n,g) * sourceScaling;
-          _source[_dofIndexPS(i,n,g,2)] = *_prob.getExtSource(i,n,g) * sourceScaling;
-          _source[_dofIndexPS(i,n,g,3)] = *_prob.getExtSource(i,n,g) * sourceScaling;
+      if (!_ownsCell(i)) continue;
+      const double* psi = &_cellFlux[ 4L*quadOrder*numGroups*_cellIndex(i) ];
+      for (int k=0; k<4*numGroups; k++)
+        phi[k] = 0.0;
+      for (int n=0; n<quadOrder; n++)
+        for (int k=0; k<4*numGroups; k++)
+          phi[k] += weights[n]*psi[4*numGroups*n + k];
+      for (int k=0; k<4*numGroups; k++)
+        phi[k] /= sumOfWeights;
+
+      Material* mat = mesh->getElementMat(i);
+      double* source = &_source[ 4L*quadOrder*numGroups*_cellIndex(i) ];
+      for (int g=0; g<numGroups; g++) {
+        if (!_groupActive[g]) continue;
+        for (int subCell=0; subCell<4; subCell++) {
+          double scatter = 0.0;
+          for (int gp=0; gp<numGroups; gp++)
+            scatter += *mat->getSigma_s(gp+1,g+1)*phi[4*gp + subCell];
+          for (int n=0; n<quadOrder; n++)
+            source[4*numGroups*n + 4*g + subCell] += scatter;
         }
       }
     }
-  }
-  else {
-    for (long i=0; i<_numPhaseSpaceDOF; i++)
-      _source[i] = 0.0;
+
+    delete [] phi;
   }
 }
 
+/// Sub-cell scalar flux kernel, ordered (cell, group, sub-cell)
+template <int G, int Q>
 void
-SolverRegMOC::_addScatterSource()
+SolverRegMOC::_scalarFluxKernel(bool activeGroupsOnly)
 {
-  // Currently only isotropic scattering is supported
-  double scattXS, scalFlux;
+  const int numGroups = G > 0 ? G : _prob.numGroups;
+  const int quadOrder = Q > 0 ? Q : _prob.quadOrder;
+  const double* weights = &_prob.weights[0];
+
+  double sumOfWeights = 0.0;
+  for (int n=0; n<quadOrder; n++)
+    sumOfWeights += weights[n];
 
-  #pragma omp parallel for private(scattXS,scalFlux)
+  #pragma omp parallel for
   for (long i=0; i<_prob.numCells; i++) {
-    for (int subCell=0; subCell<4; subCell++) {
-      for (int gp=0; gp<_prob.numGroups; gp++) {
-        scalFlux = getSubCellScalarFlux(i, gp, subCell);
-        for (int g=0; g<_prob.numGroups; g++) {
-          scattXS = *mesh->getElementMat(i)->getSigma_s(gp+1,g+1);
-          for (int n=0; n<_prob.quadOrder; n++) 
-            _source[_dofIndexPS(i,n,g,subCell)] += scalFlux*scattXS;
-        }
+    double* phi = &_scalarFlux[ 4L*numGroups*i ];
+    if (!_storesCell(i)) {
+      for (int k=0; k<4*numGroups; k++)
+        phi[k] = 0.0;
+      continue;
+    }
+    const double* psi = &_cellFlux[ 4L*quadOrder*numGroups*_cellIndex(i) ];
+    for (int g=0; g<numGroups; g++) {
+      if (activeGroupsOnly && !_groupActive[g]) continue;
+      for (int subCell=0; subCell<4; subCell++) {
+        double scalarFlux = 0.0;
+        for (int n=0; n<quadOrder; n++)
+          scalarFlux += weights[n]*psi[4*numGroups*n + 4*g + subCell];
+        phi[4*g + subCell] = scalarFlux/sumOfWeights;
       }
     }
   }
 }
 
+template <int G, int Q>
+void
+SolverRegMOC::_setKernels()
+{
+  _solveElementGroups = &SolverRegMOC::_solveElementKernel<G>;
+  _isotropicScatterSource = &SolverRegMOC::_isotropicScatterSourceKernel<G,Q>;
+  _cachedScalarFlux = &SolverRegMOC::_scalarFluxKernel<G,Q>;
+}
 
+template <int Q>
 void
-SolverRegMOC::_calculateMatrixAction(double* x, double* y)
+SolverRegMOC::_selectGroupKernels()
 {
+  switch (_prob.numGroups) {
+  case 1:  _setKernels<1,Q>(); break;
+  case 2:  _setKernels<2,Q>(); break;
+  case 4:  _setKernels<4,Q>(); break;
+  case 7:  _setKernels<7,Q>(); break;
+  case 8:  _setKernels<8,Q>(); break;
+  default: _setKernels<0,Q>(); break;
+  }
 }
 
+/// Select the kernels specialized for the number of groups and directions
+/**
+ *  Group counts and product quadrature sizes that are run most often have
+ *  their own instantiation; anything else uses the generic kernels.
+ */
+void
+SolverRegMOC::_selectKernels()
+{
+  switch (_prob.quadOrder) {
+  case 4:  _selectGroupKernels<4>(); break;
+  case 8:  _selectGroupKernels<8>(); break;
+  case 16: _selectGroupKernels<16>(); break;
+  case 32: _selectGroupKernels<32>(); break;
+  default: _selectGroupKernels<0>(); break;
+  }
+}
+
+
 double
 SolverRegMOC::getScalarFlux(long space_i, int group_g)
 {
@@ -901,6 +1001,11 @@ SolverRegMOC::getScalarFlux(long space_i, int group_g)
 double
 SolverRegMOC::getSubCellScalarFlux(long space_i, int group_g, int subCell)
 {
+  if (_reducedScalarFluxValid)
+    return _reducedScalarFlux[(space_i*_prob.numGroups + group_g)*4 + subCell];
+  if (!_storesCell(space_i))
+    return 0.0;
+
   double scalarFlux = 0;
   double sumOfWeights = 0;
   for (int n=0; n<_prob.quadOrder; n++) {
@@ -952,19 +1057,18 @@ SolverRegMOC::triangleSolveVE2(double& q, double& S, double& sigma,
 }
 
 void
-SolverRegMOC::triangleSolveA(TriangleDescriptorReg& tri, double& phi, double& theta, double& mu, long& elementID, int& n, int& g)
+SolverRegMOC::triangleSolveA(TriangleDescriptorReg& tri, double& phi, double& theta, double& mu, long&, int&, int&)
 {
   double S, psiv, q, x;
   double psi0,psi0l,psi0r,psi1,psi2,w1,w2,w3, delta;
   double deriv;
-  long edgeIndex;
 
   S = tri.d01*sin(tri.theta1)/(2.0*sin(pi-tri.theta1-phi));
   x = S*sin(phi)/sin(tri.theta1)/(tri.d12/2.0);
   S = S/sqrt(1.0 - pow(mu,2));
 
   // Cell 0: vertex to tri.edge
-  q = _source[ _dofIndexPS(elementID,n,g,tri.i0) ];
+  q = tri.q0;
   w1 = std::abs(-tri.edge01[1]*cos(theta)+tri.edge01[0]*sin(theta))/2;
   w2 = std::abs(-tri.edge20[1]*cos(theta)+tri.edge20[0]*sin(theta))/2;
   w3 = std::abs(-tri.edge12[1]*cos(theta)+tri.edge12[0]*sin(theta))/2;
@@ -975,7 +1079,7 @@ SolverRegMOC::triangleSolveA(TriangleDescriptorReg& tri, double& phi, double& th
   triangleSolveVE2(q,S,tri.sigma,w1,w2,w3,psi0r,psi0l,psi1,psi2, tri.psi01, tri.cell0);
 
   // Cell 1: edge to vertex
-  q = _source[ _dofIndexPS(elementID,n,g,tri.i1) ];
+  q = tri.q1;
   psi1 = (tri.psi4+tri.psi5)/2.0; 
   psi2 = (tri.psi0+tri.psi1)/2.0;
   deriv = psi2-psi1;
@@ -986,7 +1090,7 @@ SolverRegMOC::triangleSolveA(TriangleDescriptorReg& tri, double& phi, double& th
   //psiv = (w1*tri.psi21 + w2*tri.psi13)/w3;
   
   // Cell 2: vertex to edge
-  q = _source[ _dofIndexPS(elementID,n,g,tri.i2) ];
+  q = tri.q2;
   w1 = std::abs(-tri.edge01[1]*cos(theta)+tri.edge01[0]*sin(theta))/2;
   w2 = std::abs(-tri.edge20[1]*cos(theta)+tri.edge20[0]*sin(theta))/2;
   w3 = std::abs(-tri.edge12[1]*cos(theta)+tri.edge12[0]*sin(theta))/2;
@@ -1007,7 +1111,7 @@ SolverRegMOC::triangleSolveA(TriangleDescriptorReg& tri, double& phi, double& th
   psi1 = tri.psi01 - deriv/2.0;
 
   // Cell 3: vertex to edge
-  q = _source[ _dofIndexPS(elementID,n,g,tri.i3) ];
+  q = tri.q3;
   w1 = std::abs(-tri.edge01[1]*cos(theta)+tri.edge01[0]*sin(theta))/2;
   w2 = std::abs(-tri.edge20[1]*cos(theta)+tri.edge20[0]*sin(theta))/2;
   w3 = std::abs(-tri.edge12[1]*cos(theta)+tri.edge12[0]*sin(theta))/2;
@@ -1023,7 +1127,7 @@ SolverRegMOC::triangleSolveA(TriangleDescriptorReg& tri, double& phi, double& th
   
   if ((tri.psi01 < 0.0 || tri.psi21 < 0.0 || tri.psi13 < 0.0 || tri.psi3 < 0.0 || tri.psi2 < 0.0)) {
     LOG_DBG("NEGATIVE FLUX A-- may not be right-- check edge to vertex");
-    q = _source[ _dofIndexPS(elementID,n,g,tri.i0) ];
+    q = tri.q0;
     w1 = std::abs(-tri.edge01[1]*cos(theta)+tri.edge01[0]*sin(theta))/2;
     w2 = std::abs(-tri.edge20[1]*cos(theta)+tri.edge20[0]*sin(theta))/2;
     w3 = std::abs(-tri.edge12[1]*cos(theta)+tri.edge12[0]*sin(theta))/2;
@@ -1032,7 +1136,7 @@ SolverRegMOC::triangleSolveA(TriangleDescriptorReg& tri, double& phi, double& th
     triangleSolveVE2(q,S,tri.sigma,w1,w2,w3,psi1,psi2,psi1,psi2, tri.psi01, tri.cell0);
 
     // Cell 1: edge to vertex
-    q = _source[ _dofIndexPS(elementID,n,g,tri.i1) ];
+    q = tri.q1;
     psi1 = (tri.psi4+tri.psi5)/2.0; // wrong... no info from incoming bdry
     psi2 = (tri.psi0+tri.psi1)/2.0;
     delta = tri.psi01 - (psi1+psi2)/2.0;
@@ -1043,7 +1147,7 @@ SolverRegMOC::triangleSolveA(TriangleDescriptorReg& tri, double& phi, double& th
     triangleSolveEV(q,S,tri.sigma,x,psi1,psi2,tri.psi13,tri.psi21,tri.cell1,psiv);
   
     // Cell 2: vertex to edge
-    q = _source[ _dofIndexPS(elementID,n,g,tri.i2) ];
+    q = tri.q2;
     w1 = std::abs(-tri.edge01[1]*cos(theta)+tri.edge01[0]*sin(theta))/2;
     w2 = std::abs(-tri.edge20[1]*cos(theta)+tri.edge20[0]*sin(theta))/2;
     w3 = std::abs(-tri.edge12[1]*cos(theta)+tri.edge12[0]*sin(theta))/2;
@@ -1052,7 +1156,7 @@ SolverRegMOC::triangleSolveA(TriangleDescriptorReg& tri, double& phi, double& th
     triangleSolveVE2(q,S,tri.sigma,w1,w2,w3,psi1,psi2,psi1,psi2, tri.psi3, tri.cell2);
 
     // Cell 3: vertex to edge
-    q = _source[ _dofIndexPS(elementID,n,g,tri.i3) ];
+    q = tri.q3;
     w1 = std::abs(-tri.edge01[1]*cos(theta)+tri.edge01[0]*sin(theta))/2;
     w2 = std::abs(-tri.edge20[1]*cos(theta)+tri.edge20[0]*sin(theta))/2;
     w3 = std::abs(-tri.edge12[1]*cos(theta)+tri.edge12[0]*sin(theta))/2;
@@ -1061,14 +1165,6 @@ SolverRegMOC::triangleSolveA(TriangleDescriptorReg& tri, double& phi, double& th
     triangleSolveVE2(q,S,tri.sigma,w1,w2,w3,psi1,psi2,psi1,psi2, tri.psi2, tri.cell3);
   }
   
-
-  edgeIndex = mesh->getEdgeID(elementID,tri.edgeNeighbor);
-  _solution[ _dofIndex(edgeIndex, n, g, 0) ] = tri.psi3;
-  _solution[ _dofIndex(edgeIndex, n, g, 1) ] = tri.psi2;
-  _cellFlux[ _dofIndexPS(elementID,n,g,tri.i0) ] = tri.cell0;
-  _cellFlux[ _dofIndexPS(elementID,n,g,tri.i1) ] = tri.cell1;
-  _cellFlux[ _dofIndexPS(elementID,n,g,tri.i2) ] = tri.cell2;
-  _cellFlux[ _dofIndexPS(elementID,n,g,tri.i3) ] = tri.cell3;
 }
 
 void
@@ -1077,26 +1173,25 @@ SolverRegMOC::triangleSolveB(TriangleDescriptorReg& tri, double& phi, double& th
   double S, psiv, q, x;
   double psi0,psi0l,psi0r,psi1,psi2,w1,w2,w3,delta;
   double deriv,psiv0,psiv3;
-  long edgeIndex;
 
   S = tri.d20*sin(tri.theta0)/(2.0*sin(pi-phi));
   x = S*sin(phi-tri.theta0)/sin(tri.theta0)/(tri.d01/2.0);
   S = S/sqrt(1.0 - pow(mu,2));
 
   // Cell 0: e to v
-  q = _source[ _dofIndexPS(elementID,n,g,tri.i0) ];
+  q = tri.q0;
   psi1 = (3.0*tri.psi0-tri.psi1)/2.0;
   psi2 = (tri.psi0+tri.psi1)/2.0;
   triangleSolveEV(q,S,tri.sigma,x,psi1,psi2,tri.psi5,tri.psi01,tri.cell0,psiv0);
 
   // Cell 3: e to v
-  q = _source[ _dofIndexPS(elementID,n,g,tri.i3) ];
+  q = tri.q3;
   psi1 = (tri.psi0+tri.psi1)/2.0;
   psi2 = (3.0*tri.psi1-tri.psi0)/2.0;
   triangleSolveEV(q,S,tri.sigma,x,psi1,psi2,tri.psi13,tri.psi2,tri.cell3,psiv3);
 
   // Cell 1: v to e
-  q = _source[ _dofIndexPS(elementID,n,g,tri.i1) ];
+  q = tri.q1;
   w1 = std::abs(-tri.edge20[1]*cos(theta)+tri.edge20[0]*sin(theta))/2;
   w2 = std::abs(-tri.edge12[1]*cos(theta)+tri.edge12[0]*sin(theta))/2;
   w3 = std::abs(-tri.edge01[1]*cos(theta)+tri.edge01[0]*sin(theta))/2;
@@ -1114,7 +1209,7 @@ SolverRegMOC::triangleSolveB(TriangleDescriptorReg& tri, double& phi, double& th
   triangleSolveVE2(q,S,tri.sigma,w1,w2,w3,psi0r,psi0l,psi1,psi2, tri.psi21, tri.cell1);
   
   // Cell 2: e to v
-  q = _source[ _dofIndexPS(elementID,n,g,tri.i2) ];
+  q = tri.q2;
   psi1 = (w1*tri.psi5+w2*tri.psi01)/w3;
   psi2 = (w1*tri.psi13+w2*tri.psi2)/w3;  // may need to switch
   psi1 = psiv0;
@@ -1129,19 +1224,19 @@ SolverRegMOC::triangleSolveB(TriangleDescriptorReg& tri, double& phi, double& th
     LOG_DBG("Going to zero order");
     LOG_DBG(elementID, " ", n, " ", g);
     // Cell 0: e to v
-    q = _source[ _dofIndexPS(elementID,n,g,tri.i0) ];
+    q = tri.q0;
     psi1 = tri.psi0;
     psi2 = tri.psi0;
     triangleSolveEV(q,S,tri.sigma,x,psi1,psi2,tri.psi01,tri.psi5,tri.cell0,psiv);
 
     // Cell 3: e to v
-    q = _source[ _dofIndexPS(elementID,n,g,tri.i3) ];
+    q = tri.q3;
     psi1 = tri.psi1;
     psi2 = tri.psi1;
     triangleSolveEV(q,S,tri.sigma,x,psi1,psi2,tri.psi2,tri.psi13,tri.cell3,psiv);
 
     // Cell 1: v to e
-    q = _source[ _dofIndexPS(elementID,n,g,tri.i1) ];
+    q = tri.q1;
     w1 = std::abs(-tri.edge20[1]*cos(theta)+tri.edge20[0]*sin(theta))/2;
     w2 = std::abs(-tri.edge12[1]*cos(theta)+tri.edge12[0]*sin(theta))/2;
     w3 = std::abs(-tri.edge01[1]*cos(theta)+tri.edge01[0]*sin(theta))/2;
@@ -1150,21 +1245,10 @@ SolverRegMOC::triangleSolveB(TriangleDescriptorReg& tri, double& phi, double& th
     triangleSolveVE2(q,S,tri.sigma,w1,w2,w3,psi1,psi2,psi1,psi2, tri.psi21, tri.cell1);
 
     // Cell 2: e to v
-    q = _source[ _dofIndexPS(elementID,n,g,tri.i2) ];
+    q = tri.q2;
     psi1 = tri.psi21; // could impose a shape from the boundary points
     psi2 = tri.psi21;
     triangleSolveEV(q,S,tri.sigma,x,psi1,psi2,tri.psi3,tri.psi4,tri.cell2,psiv);
   }
   
-
-  edgeIndex = mesh->getEdgeID(elementID,tri.vertexNeighbor1);
-  _solution[ _dofIndex(edgeIndex, n, g, 0) ] = tri.psi3;
-  _solution[ _dofIndex(edgeIndex, n, g, 1) ] = tri.psi2;
-  edgeIndex = mesh->getEdgeID(elementID,tri.vertexNeighbor2);
-  _solution[ _dofIndex(edgeIndex, n, g, 0) ] = tri.psi5;
-  _solution[ _dofIndex(edgeIndex, n, g, 1) ] = tri.psi4;
-  _cellFlux[ _dofIndexPS(elementID,n,g,tri.i0) ] = tri.cell0;
-  _cellFlux[ _dofIndexPS(elementID,n,g,tri.i1) ] = tri.cell1;
-  _cellFlux[ _dofIndexPS(elementID,n,g,tri.i2) ] = tri.cell2;
-  _cellFlux[ _dofIndexPS(elementID,n,g,tri.i3) ] = tri.cell3;
 }
@@ -27,6 +27,21 @@ Transient::Transient(InputParser& input)
   if (s == "zero") {
     solver->zeroSolution();
   }
+  else if (s == "eigenvalue") {
+    // Generate the initial condition from an eigenvalue calculation
+    LOG("Calculating initial condition from eigenvalue problem.");
+    solver->eigenvalueMode = true;
+    solver->sourceConfig.hasExternalSource = false;
+    solver->sourceConfig.hasScatterSource = true;
+    solver->sourceConfig.hasFissionSource = true;
+    solver->sourceConfig.hasTransientSource = false;
+    _solveWithWarmStart();
+    solver->eigenvalueMode = false;
+
+    _criticalEigenvalue = solver->criticalEigenvalue;
+    LOG("Critical eigenvalue = ", _criticalEigenvalue);
+    solver->normalizeSolution(_criticalEigenvalue);
+  }
   else {
     // Assume the input string contains an HDF file containing the IC solution data
     HDF5Interface hdf;
@@ -44,7 +59,7 @@ Transient::Transient(InputParser& input)
     var = "solution";
     data.data = hdf.readData(s, var);
     
-    if (data.data->dims[0] == solver->getNumDOFs()) {
+    if (data.data->dims[0] == solver->getNumGlobalDOFs()) {
       solver->setSolution(data.getData());
       solver->normalizeSolution(_criticalEigenvalue);
     }
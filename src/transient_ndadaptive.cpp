@@ -2,6 +2,7 @@
 #include "material.h"
 #include "perfstats.h"
 #include "log.h"
+#include "parallel.h"
 
 #include <cmath>
 #include <iostream>
@@ -37,6 +38,9 @@ Transient_NDAdaptive::Transient_NDAdaptive(InputParser& input)
   else
     _dtRelChange = v[0];
 
+  // The per-step solves need not be more accurate than the local truncation error
+  solver->setInexactTol(0.1*_delta);
+
   LOG("LTE Tolerance = ", _delta);
   LOG("dtMin = ", _dtMin);
   LOG("dtMax = ", _dtMax);
@@ -154,6 +158,7 @@ Transient_NDAdaptive::_getTimeStep()
     _dtRec = fmin(_dtRec, sqrt(2.0*_delta*fabs(*solver->getSolutionValue(i)/solnSecDer[i])));
   }
 
-  return _dtRec;
+  // Ranks keep different parts of the solution but must take the same step
+  return -Parallel::maxAll(-_dtRec);
 
 }
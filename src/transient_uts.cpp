@@ -3,6 +3,8 @@
 #include "perfstats.h"
 #include "log.h"
 
+#include <cmath>
+
 Transient_UTS::Transient_UTS(InputParser& input)
   : Transient(input)
 {
@@ -24,7 +26,7 @@ Transient_UTS::execute()
 
   // Solve the transient
   double t = _dt;
-  double totalNeutronProduction;
+  double totalNeutronProduction = 0.0;
   double _dtNext;
   unsigned int numTimeSteps = 0;
   while (t < _tMax) {
@@ -56,9 +58,15 @@ Transient_UTS::execute()
     _output->streamOutput("time", t);
 
     // Calculate the total neutron production
+    double totalNeutronProductionPrev = totalNeutronProduction;
     totalNeutronProduction = solver->getTotalNeutronProduction() / _criticalEigenvalue;
     _output->streamOutput("totalNeutronProduction", totalNeutronProduction);
 
+    // Solve the next step only as accurately as the step-to-step change warrants
+    if (numTimeSteps > 1 && totalNeutronProduction > 0.0)
+      solver->setInexactTol(0.1*std::abs(totalNeutronProduction - totalNeutronProductionPrev)
+                            / totalNeutronProduction);
+
     // Setup next time step
     _dt = _dtNext;
     t += t+_dt>_tMax ? _tMax-t : _dt;
@@ -1,10 +1,15 @@
 #include "transportproblem.h"
+#include "legendre.h"
+#include "moabmesh.h"
+#include "global.h"
 #include "log.h"
 
 #include "hdf5interface.h"
 
+#include <cmath>
+
 TransportProblem::TransportProblem(InputParser& input, MeshFactory& meshFactory, int numGroups_in) :
-  numGroups(numGroups_in), scatterAnisotropy(0)
+  numGroups(numGroups_in), scatterAnisotropy(0), sweepOrderOffset(0), numSources(1)
 {
   // Make problem
   std::cout << "Making problem... ";
@@ -63,9 +68,12 @@ TransportProblem::TransportProblem(InputParser& input, MeshFactory& meshFactory,
   bcLeft = vacuum;
   bcRight = vacuum;
 
+  // Without an angular quadrature (e.g., diffusion) an isotropic source is stored
+  numSourceAngles = (quadOrder > 0) ? quadOrder : 1;
+
   // Always allocate space, because this is used by eigenvalue and transient
-  extSource = new double [ numCells*quadOrder*numGroups ];
-  for (long i=0; i<numCells*quadOrder*numGroups; i++)  {
+  extSource = new double [ numCells*numSourceAngles*numGroups ];
+  for (long i=0; i<numCells*numSourceAngles*numGroups; i++)  {
     extSource[i] = 0.0;
   }
 
@@ -82,7 +90,7 @@ TransportProblem::TransportProblem(InputParser& input, MeshFactory& meshFactory,
       double srcMagnitude = v[0];
       for (int g=0; g<numGroups; g++) {
         for (int i=0; i<numCells; i++) {
-          for (int n=0; n<quadOrder; n++) {
+          for (int n=0; n<numSourceAngles; n++) {
             putExtSource(i,n,g, srcMagnitude);
           }
         }
@@ -96,10 +104,23 @@ TransportProblem::TransportProblem(InputParser& input, MeshFactory& meshFactory,
       h5.open(fileName,'R');
       HDFData* sourceData = h5.readData(fileName, varName);
       srcArray = (double*)sourceData->data;
+
+      // The file may hold several sources, one after another
+      long sourceSize = 1;
+      for (int d=0; d<sourceData->rank; d++)
+        sourceSize *= sourceData->dims[d];
+      numSources = sourceSize/(numCells*numSourceAngles);
+      if (numSources < 1 || sourceSize != numSources*numCells*numSourceAngles)
+        LOG_ERR("Source file ", fileName, " size is not a multiple of the number of cells times angles.");
+      if (numSources > 1) {
+        LOG("Read ", numSources, " external sources from ", fileName);
+        _batchSource.assign(srcArray, srcArray + sourceSize);
+      }
+
       for (int g=0; g<numGroups; g++) {
         for (int i=0; i<numCells; i++) {
-          for (int n=0; n<quadOrder; n++) {
-            putExtSource(i,n,g, srcArray[i*quadOrder + n]);
+          for (int n=0; n<numSourceAngles; n++) {
+            putExtSource(i,n,g, srcArray[i*numSourceAngles + n]);
           }
         }
       }
@@ -107,6 +128,9 @@ TransportProblem::TransportProblem(InputParser& input, MeshFactory& meshFactory,
     }
     else if (genString == "boundary") {
       nxnyq = input.getVector(path, "nxnyq");
+      std::string fileName = input.getString(path, "file");
+      if (fileName != "empty")
+        _readBoundarySource(fileName);
     }
     else {
       LOG_ERR("Invalid source type: ", genString);
@@ -117,8 +141,8 @@ TransportProblem::TransportProblem(InputParser& input, MeshFactory& meshFactory,
   }
   
   // Allocate space for reference solution
-  refSolution = new double [ numCells*quadOrder*numGroups ];
-  for (long i=0; i<numCells*quadOrder*numGroups; i++)  {
+  refSolution = new double [ numCells*numSourceAngles*numGroups ];
+  for (long i=0; i<numCells*numSourceAngles*numGroups; i++)  {
     refSolution[i] = 1.0e30;
   }
   
@@ -126,6 +150,176 @@ TransportProblem::TransportProblem(InputParser& input, MeshFactory& meshFactory,
 
 }
 
+/// Coarse angular quadrature version of a transport problem
+/**
+ *  Copies the mesh, boundary conditions, and sources from fineProblem, but uses
+ *  a product quadrature with polarOrder Gauss-Legendre polar cosines (only the
+ *  positive half is kept) and 4*polarOrder azimuthal angles.  If the fine
+ *  quadrature is planar (omega_z = 0), only the 4*polarOrder planar directions are
+ *  kept.  The external source is replaced by its angular average, and sweep
+ *  orderings for the new directions are added to the mesh.
+ */
+TransportProblem::TransportProblem(TransportProblem& fineProblem, int polarOrder) :
+  mesh(fineProblem.mesh), numCells(fineProblem.numCells), numEdges(fineProblem.numEdges),
+  numNodes(fineProblem.numNodes), numGroups(fineProblem.numGroups),
+  scatterAnisotropy(fineProblem.scatterAnisotropy), hasFixedSource(fineProblem.hasFixedSource),
+  numSources(1),
+  bcLeft(fineProblem.bcLeft), bcRight(fineProblem.bcRight), globalBC(fineProblem.globalBC),
+  nxnyq(fineProblem.nxnyq)
+{
+  bool planar = true;
+  for (int n=0; n<fineProblem.quadOrder; n++)
+    if (fineProblem.omega_z[n] != 0.0) planar = false;
+  _generateProductQuadrature(polarOrder, planar);
+  numSourceAngles = quadOrder;
+
+  // Angular average of the fine-quadrature source
+  double sumOfWeights = 0.0;
+  for (int n=0; n<fineProblem.quadOrder; n++)
+    sumOfWeights += fineProblem.weights[n];
+
+  extSource = new double [ numCells*quadOrder*numGroups ];
+  refSolution = new double [ numCells*quadOrder*numGroups ];
+  for (int g=0; g<numGroups; g++) {
+    for (long i=0; i<numCells; i++) {
+      double src = 0.0;
+      for (int n=0; n<fineProblem.quadOrder; n++)
+        src += fineProblem.weights[n] * *fineProblem.getExtSource(i,n,g);
+      src = src/sumOfWeights;
+      for (int n=0; n<quadOrder; n++) {
+        putExtSource(i,n,g, src);
+        putRefSolution(i,n,g, 1.0e30);
+      }
+    }
+  }
+
+  // Boundary sources from file are replaced by their angular average
+  std::map<long, long>::iterator it;
+  for (it = fineProblem.boundarySourceOffset.begin(); it != fineProblem.boundarySourceOffset.end(); ++it) {
+    long offset = boundarySource.size();
+    boundarySourceOffset[it->first] = offset;
+    boundarySource.resize(offset + quadOrder*numGroups);
+    for (int g=0; g<numGroups; g++) {
+      double src = 0.0;
+      for (int n=0; n<fineProblem.quadOrder; n++)
+        src += fineProblem.weights[n] * *fineProblem.getBoundarySource(it->first,n,g);
+      src = src/sumOfWeights;
+      for (int n=0; n<quadOrder; n++)
+        boundarySource[offset + numGroups*n + g] = src;
+    }
+  }
+
+  // Sweep orderings for the new directions
+  sweepOrderOffset = 0;
+  MoabMesh* moabMesh = dynamic_cast<MoabMesh*>(mesh);
+  if (moabMesh)
+    sweepOrderOffset = moabMesh->createMeshSweepOrder(omega_x, omega_y);
+}
+
+/// Make source number source (of numSources) the external source
+void
+TransportProblem::selectSource(int source)
+{
+  if (_batchSource.size() == 0)
+    return;
+
+  long offset = source*numCells*numSourceAngles;
+  for (int g=0; g<numGroups; g++) {
+    for (long i=0; i<numCells; i++) {
+      for (int n=0; n<numSourceAngles; n++) {
+        putExtSource(i,n,g, _batchSource[offset + i*numSourceAngles + n]);
+      }
+    }
+  }
+}
+
+/// Read incoming boundary angular fluxes from an HDF5 file
+/**
+ *  The file holds the boundary edge IDs in "/boundaryEdges" and the incoming
+ *  angular fluxes in "/boundaryFlux", ordered by edge, angle, group.  This is
+ *  the layout written by SolverMOC::writeBoundaryFlux (both MOC solvers), so
+ *  the outgoing flux of one calculation can be used as the boundary source of
+ *  another.
+ */
+void
+TransportProblem::_readBoundarySource(std::string fileName)
+{
+  HDF5Interface h5;
+  h5.open(fileName,'R');
+  HDFData* edgeData = h5.readData(fileName, "/boundaryEdges");
+  HDFData* fluxData = h5.readData(fileName, "/boundaryFlux");
+  h5.close(fileName);
+
+  long numBoundaryEdges = edgeData->dims[0];
+  long fluxSize = 1;
+  for (int d=0; d<fluxData->rank; d++)
+    fluxSize *= fluxData->dims[d];
+
+  if (fluxSize != numBoundaryEdges*quadOrder*numGroups) {
+    LOG_ERR("Boundary source file ", fileName, " has ", fluxSize, " values, but ",
+            numBoundaryEdges*quadOrder*numGroups, " are needed.");
+  }
+  else {
+    int* edges = (int*)edgeData->data;
+    double* flux = (double*)fluxData->data;
+    boundarySource.assign(flux, flux + fluxSize);
+    for (long e=0; e<numBoundaryEdges; e++)
+      boundarySourceOffset[ edges[e] ] = e*quadOrder*numGroups;
+    LOG("Read boundary sources for ", numBoundaryEdges, " edges from ", fileName);
+  }
+
+  delete [] (int*)edgeData->data;
+  delete [] (double*)fluxData->data;
+  delete edgeData;
+  delete fluxData;
+}
+
+/// Generate a Gauss-Legendre/equal-spaced azimuthal product quadrature
+void
+TransportProblem::_generateProductQuadrature(int polarOrder, bool planar)
+{
+  // Positive Gauss-Legendre roots and weights by Newton iteration
+  std::vector<double> mu, muWeight;
+  LegendrePolynomial P(polarOrder);
+  for (int k=0; k<polarOrder/2; k++) {
+    double x = cos(pi*(k + 0.75)/(polarOrder + 0.5));
+    double dP;
+    for (int iter=0; iter<100; iter++) {
+      P.evaluate(x);
+      dP = polarOrder*(x*P[polarOrder] - P[polarOrder-1])/(x*x - 1.0);
+      double dx = P[polarOrder]/dP;
+      x -= dx;
+      if (std::abs(dx) < 1.0e-15) break;
+    }
+    P.evaluate(x);
+    dP = polarOrder*(x*P[polarOrder] - P[polarOrder-1])/(x*x - 1.0);
+    mu.push_back(x);
+    muWeight.push_back(2.0/((1.0 - x*x)*dP*dP));
+  }
+  if (planar) {
+    mu.assign(1, 0.0);
+    muWeight.assign(1, 1.0);
+  }
+
+  double sumOfMuWeights = 0.0;
+  for (int k=0; k<mu.size(); k++)
+    sumOfMuWeights += muWeight[k];
+
+  int numTheta = 4*polarOrder;
+  double dtheta = 2.0*pi/numTheta;
+  omega_x.clear();  omega_y.clear();  omega_z.clear();  weights.clear();
+  for (int k=0; k<mu.size(); k++) {
+    for (int i=0; i<numTheta; i++) {
+      double theta = dtheta/2.0 + dtheta*i;
+      omega_x.push_back( sqrt(1.0 - mu[k]*mu[k])*cos(theta) );
+      omega_y.push_back( sqrt(1.0 - mu[k]*mu[k])*sin(theta) );
+      omega_z.push_back( mu[k] );
+      weights.push_back( 4.0*pi*muWeight[k]/(sumOfMuWeights*numTheta) );
+    }
+  }
+  quadOrder = omega_x.size();
+}
+
 TransportProblem::~TransportProblem()
 {
   delete [] extSource;